@@ -1,91 +1,536 @@
 #include "emulator/compiletime/codegen.h"
 #include "shared/log.h"
+#include "shared/memory.h"
+#include "shared/buffer.h"
+#include "shared/platform.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-static void outputCommand(VMCoreGen* core, FILE* file, unsigned int command) {
+// the code run by a command, with the command's arguments substituted, or
+// NULL if the generated code includes its template instead
+typedef const char** CommandCode;
+
+static void outputCommand(VMCoreGen* core, CommandCode code, Buffer* file,
+    unsigned int command) {
     CONTEXT(INFO, "Command = %u", command);
+    if(code != NULL) {
+        bufferPuts(file, code[command]);
+        return;
+    }
+
     for(unsigned int k = 0; k < core->commands[command].argsLength; k++) {
         Argument* arg = &core->commands[command].args[k];
-        fprintf(file, "#define %s %s\n", arg->name, arg->value);
+        bufferPrintf(file, "#define %s %s\n", arg->name, arg->value);
     }
-    fprintf(file, "#include \"%s%s.c\"\n", core->codeIncludeBase, core->commands[command].file);
+    bufferPrintf(file, "#include \"%s%s.c\"\n", core->codeIncludeBase, core->commands[command].file);
     for(unsigned int k = 0; k < core->commands[command].argsLength; k++) {
         Argument* arg = &core->commands[command].args[k];
-        fprintf(file, "#undef %s\n", arg->name);
+        bufferPrintf(file, "#undef %s\n", arg->name);
+    }
+}
+
+static bool isIdentifierStart(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool isIdentifierChar(char c) {
+    return isIdentifierStart(c) || (c >= '0' && c <= '9');
+}
+
+// copy a template, replacing each identifier naming one of the command's
+// arguments with its value, as defining the arguments before including the
+// template would.  Strings, characters and comments are copied unchanged
+static const char* expandTemplate(Command* command, FileBuffer* source) {
+    Buffer code;
+    bufferInit(&code);
+
+    const char* c = source->data;
+    const char* end = source->data + source->length;
+    while(c < end) {
+        const char* start = c;
+        if(*c == '"' || *c == '\'') {
+            char quote = *c++;
+            while(c < end && *c != quote && *c != '\n') {
+                if(*c == '\\' && c + 1 < end) {
+                    c++;
+                }
+                c++;
+            }
+            if(c < end && *c == quote) {
+                c++;
+            }
+        } else if(c + 1 < end && c[0] == '/' && c[1] == '/') {
+            while(c < end && *c != '\n') {
+                c++;
+            }
+        } else if(c + 1 < end && c[0] == '/' && c[1] == '*') {
+            c += 2;
+            while(c + 1 < end && !(c[0] == '*' && c[1] == '/')) {
+                c++;
+            }
+            c = c + 1 < end ? c + 2 : end;
+        } else if(isIdentifierChar(*c)) {
+            // numbers are skipped whole, so 0x7F is not read as x7F and
+            // 1e-5 as e, but identifiers stop at '.' so arg.field is found
+            bool number = !isIdentifierStart(*start);
+            while(c < end) {
+                if(isIdentifierChar(*c) || (number && *c == '.')) {
+                    c++;
+                } else if(number && (*c == '+' || *c == '-') &&
+                          strchr("eEpP", c[-1]) != NULL) {
+                    c++;
+                } else {
+                    break;
+                }
+            }
+            if(isIdentifierStart(*start)) {
+                size_t length = c - start;
+                for(unsigned int i = 0; i < command->argsLength; i++) {
+                    Argument* arg = &command->args[i];
+                    if(strlen(arg->name) == length &&
+                       memcmp(arg->name, start, length) == 0) {
+                        bufferPuts(&code, arg->value);
+                        start = c;
+                        break;
+                    }
+                }
+            }
+        } else {
+            c++;
+        }
+        bufferWrite(&code, start, c - start);
+    }
+
+    if(code.charCount > 0 && code.chars[code.charCount - 1] != '\n') {
+        bufferPutc(&code, '\n');
+    }
+    return code.chars;
+}
+
+// read each runtime template once and expand it for every command using it,
+// so the compiler does not have to open the template for every use
+static bool loadCommandCode(VMCoreGen* core, CodegenOptions* options,
+    CommandCode* code) {
+    CONTEXT(INFO, "Loading runtime templates");
+
+    *code = NULL;
+    if(options->templateDir == NULL) {
+        return true;
     }
+
+    Table files;
+    initTable(&files, strHash, strCmp);
+    const char** commandCode = ArenaAlloc(sizeof(const char*) *
+        (core->commandCount + 1));
+    for(unsigned int i = 0; i < core->commandCount; i++) {
+        Command* command = &core->commands[i];
+        FileBuffer* source;
+        if(!tableGet(&files, (void*)command->file, (void**)&source)) {
+            const char* path = aprintf("%s%c%s%s.c", options->templateDir,
+                pathSeperator, core->codeIncludeBase, command->file);
+            source = ArenaAlloc(sizeof(FileBuffer));
+            if(!mapFile(path, source)) {
+                cErrPrintf(TextRed, "Could not read runtime template \"%s\"\n",
+                    path);
+                return false;
+            }
+            tableSet(&files, (void*)command->file, source);
+        }
+        commandCode[i] = expandTemplate(command, source);
+    }
+
+    *code = commandCode;
+    return true;
 }
 
-static void outputLoop(VMCoreGen* core, FILE* file) {
+static int headerSort(const void* a, const void* b) {
+    return strcmp(*(const char**)a, *(const char**)b);
+}
+
+// headers are sorted so the output does not depend on the table's layout
+static void outputHeaders(VMCoreGen* core, Buffer* file) {
+    unsigned int count = 0;
+    const char* headers[core->headers.count + 1];
+    for(unsigned int i = 0; i < core->headers.capacity; i++) {
+        Entry* entry = &core->headers.entries[i];
+        if(entry->key.value != NULL) {
+            headers[count++] = entry->key.value;
+        }
+    }
+
+    qsort(headers, count, sizeof(const char*), headerSort);
+    for(unsigned int i = 0; i < count; i++) {
+        bufferPrintf(file, "#include %s\n", headers[i]);
+    }
+}
+
+// output the body of a single case in the opcode switch
+static void outputOpcode(VMCoreGen* core, CommandCode commandCode,
+    Buffer* file, GenOpCode* code) {
+    DEBUG("Outputting code %u = %.*s", code->id, code->nameLen, code->name);
+    bufferPrintf(file, "// %.*s\ncase %u:\n", code->nameLen, code->name, code->id);
+    for(unsigned int j = 0; j < code->lineCount; j++) {
+        GenOpCodeLine* line = code->lines[j];
+        if(line->hasCondition) {
+            bufferPuts(file, "if((conditions >> currentCondition)&1) {\n");
+            for(unsigned int k = 0; k < line->highBitCount; k++) {
+                outputCommand(core, commandCode, file, line->highBits[k]);
+            }
+            bufferPuts(file, "} else {\n");
+            for(unsigned int k = 0; k < line->lowBitCount; k++) {
+                outputCommand(core, commandCode, file, line->lowBits[k]);
+            }
+            bufferPuts(file, "}\n");
+        } else {
+            for(unsigned int k = 0; k < line->lowBitCount; k++) {
+                outputCommand(core, commandCode, file, line->lowBits[k]);
+            }
+        }
+    }
+    bufferPuts(file, "break;\n");
+}
+
+static void outputLoop(VMCoreGen* core, CommandCode commandCode,
+    Buffer* file) {
     CONTEXT(INFO, "VM File Write");
     for(unsigned int i = 0; i < core->variableCount; i++) {
-        fprintf(file, "%s = {0};\n", core->variables[i]);
+        bufferPrintf(file, "%s = {0};\n", core->variables[i]);
     }
 
-    fputs("while(true) {\n", file);
+    bufferPuts(file, "while(true) {\n");
 
     for(unsigned int i = 0; i < core->loopVariableCount; i++) {
-        fprintf(file, "%s = {0};\n", core->loopVariables[i]);
+        bufferPrintf(file, "%s = {0};\n", core->loopVariables[i]);
     }
 
     for(unsigned int i = 0; i < core->headBitCount; i++) {
-        outputCommand(core, file, core->headBits[i]);
+        outputCommand(core, commandCode, file, core->headBits[i]);
     }
 
-    fputs("switch(opcode) {\n", file);
+    bufferPuts(file, "switch(opcode) {\n");
 
     for(unsigned int i = 0; i < core->opcodeCount; i++) {
         GenOpCode* code = &core->opcodes[i];
         if(!code->isValid) {
             continue;
         }
-        DEBUG("Outputting code %u = %.*s", code->id, code->nameLen, code->name);
-        fprintf(file, "// %.*s\ncase %u:\n", code->nameLen, code->name, code->id);
-        for(unsigned int j = 0; j < code->lineCount; j++) {
-            GenOpCodeLine* line = code->lines[j];
-            if(line->hasCondition) {
-                fputs("if((conditions >> currentCondition)&1) {\n", file);
+        outputOpcode(core, commandCode, file, code);
+    }
+
+    bufferPuts(file, "default: exit(0);\n");
+
+    bufferPuts(file, "}\nIP++;\n}}\n");
+}
+
+// the name of the variable created by a "type name" declaration
+static const char* variableName(const char* declaration) {
+    const char* space = strrchr(declaration, ' ');
+    return space == NULL ? declaration : space + 1;
+}
+
+// the vm state shared between the driver and the opcode handlers,
+// every generated file gets an identical copy of the definition
+static void outputState(VMCoreGen* core, Buffer* file) {
+    bufferPuts(file, "typedef struct EmuState {\n");
+    for(unsigned int i = 0; i < core->variableCount; i++) {
+        bufferPrintf(file, "%s;\n", core->variables[i]);
+    }
+    for(unsigned int i = 0; i < core->loopVariableCount; i++) {
+        bufferPrintf(file, "%s;\n", core->loopVariables[i]);
+    }
+    bufferPuts(file, "uint16_t* memory;\nFILE* logFile;\n} EmuState;\n");
+}
+
+// copy the state into locals, so the runtime templates can refer to the
+// vm's variables by name
+static void outputStateLoad(VMCoreGen* core, Buffer* file) {
+    for(unsigned int i = 0; i < core->variableCount; i++) {
+        bufferPrintf(file, "%s = state->%s;\n", core->variables[i],
+            variableName(core->variables[i]));
+    }
+    for(unsigned int i = 0; i < core->loopVariableCount; i++) {
+        bufferPrintf(file, "%s = state->%s;\n", core->loopVariables[i],
+            variableName(core->loopVariables[i]));
+    }
+    bufferPuts(file, "uint16_t* memory = state->memory;\n(void)memory;\n");
+    bufferPuts(file, "FILE* logFile = state->logFile;\n(void)logFile;\n");
+}
+
+static void outputStateStore(VMCoreGen* core, Buffer* file) {
+    for(unsigned int i = 0; i < core->variableCount; i++) {
+        const char* name = variableName(core->variables[i]);
+        bufferPrintf(file, "state->%s = %s;\n", name, name);
+    }
+    for(unsigned int i = 0; i < core->loopVariableCount; i++) {
+        const char* name = variableName(core->loopVariables[i]);
+        bufferPrintf(file, "state->%s = %s;\n", name, name);
+    }
+}
+
+// name of the split file containing handlers for part n
+static char* partFileName(const char* filename, unsigned int part) {
+    size_t len = strlen(filename);
+    if(len > 2 && strcmp(filename + len - 2, ".c") == 0) {
+        len -= 2;
+    }
+    return aprintf("%.*s_%u.c", (int)len, filename, part);
+}
+
+// function handling all opcodes in [start, end)
+static void outputPartFunction(VMCoreGen* core, CommandCode commandCode,
+    Buffer* file, unsigned int part, const char* suffix, unsigned int start,
+    unsigned int end) {
+    CONTEXT(INFO, "Writing opcode handler %u%s", part, suffix);
+
+    bufferPrintf(file, "void emulatorPart%u%s(EmuState* state) {\n", part, suffix);
+    outputStateLoad(core, file);
+    bufferPuts(file, "switch(opcode) {\n");
+    for(unsigned int i = start; i < end; i++) {
+        GenOpCode* code = &core->opcodes[i];
+        if(!code->isValid) {
+            continue;
+        }
+        outputOpcode(core, commandCode, file, code);
+    }
+    bufferPuts(file, "default: exit(0);\n}\n");
+    outputStateStore(core, file);
+    bufferPuts(file, "}\n");
+}
+
+// function running the header commands, shared by every opcode
+static void outputHeadFunction(VMCoreGen* core, CommandCode commandCode,
+    Buffer* file, const char* suffix) {
+    bufferPrintf(file, "static void emulatorHead%s(EmuState* state) {\n", suffix);
+    outputStateLoad(core, file);
+    for(unsigned int i = 0; i < core->headBitCount; i++) {
+        outputCommand(core, commandCode, file, core->headBits[i]);
+    }
+    outputStateStore(core, file);
+    bufferPuts(file, "}\n");
+}
+
+// loop calling the header function, then the handler owning the opcode
+static void outputDriverLoop(VMCoreGen* core, Buffer* file, const char* suffix,
+    unsigned int splitCount, unsigned int* bounds) {
+    bufferPuts(file, "while(true) {\n");
+    for(unsigned int i = 0; i < core->loopVariableCount; i++) {
+        bufferPrintf(file, "state.%s = 0;\n", variableName(core->loopVariables[i]));
+    }
+    bufferPrintf(file, "emulatorHead%s(&state);\n", suffix);
+    for(unsigned int i = 0; i < splitCount - 1; i++) {
+        bufferPrintf(file, "%sif(state.opcode < %u) {\nemulatorPart%u%s(&state);\n}",
+            i == 0 ? "" : " else ", bounds[i + 1], i, suffix);
+    }
+    bufferPrintf(file, "%semulatorPart%u%s(&state);\n%s", splitCount > 1 ?
+        " else {\n" : "", splitCount - 1, suffix, splitCount > 1 ? "}\n" : "");
+    bufferPuts(file, "state.IP++;\n}\n");
+}
+
+// write a generated buffer to disk, leaving unchanged files untouched so
+// they are not recompiled
+static bool outputFile(Buffer* file, const char* filename) {
+    if(!writeFileIfChanged(filename, file->chars, file->charCount)) {
+        cErrPrintf(TextRed, "Could not write generated code to \"%s\"\n",
+            filename);
+        return false;
+    }
+    return true;
+}
+
+static bool outputSplit(VMCoreGen* core, CodegenOptions* options,
+    CommandCode commandCode, Buffer* file) {
+    CONTEXT(INFO, "Running split codegen, %u parts", options->splitCount);
+    unsigned int splitCount = options->splitCount;
+
+    // partition the opcode space so each file gets a similar number of
+    // valid opcodes, bounds[i] is the first opcode handled by part i
+    unsigned int validCount = 0;
+    for(unsigned int i = 0; i < core->opcodeCount; i++) {
+        validCount += core->opcodes[i].isValid;
+    }
+    unsigned int perPart = (validCount + splitCount - 1) / splitCount;
+    unsigned int* bounds = ArenaAlloc(sizeof(unsigned int) * (splitCount + 1));
+    unsigned int part = 1;
+    unsigned int seen = 0;
+    bounds[0] = 0;
+    for(unsigned int i = 0; i < core->opcodeCount && part < splitCount; i++) {
+        if(!core->opcodes[i].isValid) {
+            continue;
+        }
+        seen++;
+        if(seen == perPart * part) {
+            bounds[part++] = i + 1;
+        }
+    }
+    while(part <= splitCount) {
+        bounds[part++] = core->opcodeCount;
+    }
+
+    bool success = true;
+    for(unsigned int i = 0; i < splitCount; i++) {
+        const char* partName = partFileName(options->filename, i);
+        DEBUG("Writing opcodes [%u, %u) to %s", bounds[i], bounds[i + 1],
+            partName);
+        bufferClear(file);
+        outputHeaders(core, file);
+        outputState(core, file);
+        outputPartFunction(core, commandCode, file, i, "", bounds[i],
+            bounds[i + 1]);
+        bufferPuts(file, "#define DEBUG_OUTPUT\n");
+        outputPartFunction(core, commandCode, file, i, "Verbose", bounds[i],
+            bounds[i + 1]);
+        success &= outputFile(file, partName);
+    }
+
+    bufferClear(file);
+    outputHeaders(core, file);
+    outputState(core, file);
+    for(unsigned int i = 0; i < splitCount; i++) {
+        bufferPrintf(file, "void emulatorPart%u(EmuState* state);\n", i);
+        bufferPrintf(file, "void emulatorPart%uVerbose(EmuState* state);\n", i);
+    }
+
+    outputHeadFunction(core, commandCode, file, "");
+    bufferPuts(file, "void emulator(uint16_t* memory) {\n");
+    bufferPuts(file, "EmuState state = {0};\nstate.memory = memory;\n");
+    outputDriverLoop(core, file, "", splitCount, bounds);
+    bufferPuts(file, "}\n");
+
+    bufferPuts(file, "#define DEBUG_OUTPUT\n");
+    outputHeadFunction(core, commandCode, file, "Verbose");
+    bufferPuts(file, "void emulatorVerbose(uint16_t* memory, FILE* logFile) {\n");
+    bufferPuts(file, "EmuState state = {0};\nstate.memory = memory;\n"
+        "state.logFile = logFile;\n");
+    outputDriverLoop(core, file, "Verbose", splitCount, bounds);
+    bufferPuts(file, "}\n");
+
+    return success && outputFile(file, options->filename);
+}
+
+// write a path to a depfile, escaping characters make would interpret
+static void outputDepfilePath(Buffer* file, const char* path) {
+    bufferPuts(file, " \\\n  ");
+    for(const char* c = path; *c != '\0'; c++) {
+        switch(*c) {
+            case ' ':
+            case '#':
+                bufferPutc(file, '\\');
+                bufferPutc(file, *c);
+                break;
+            case '$':
+                bufferPuts(file, "$$");
+                break;
+            default:
+                bufferPutc(file, *c);
+        }
+    }
+}
+
+// record a command's runtime template as a dependency, if not already listed
+static void addTemplateDependency(VMCoreGen* core, CodegenOptions* options,
+    Buffer* file, Table* seen, unsigned int command) {
+    const char* name = core->commands[command].file;
+    if(tableHas(seen, (void*)name)) {
+        return;
+    }
+    tableSet(seen, (void*)name, (void*)1);
+    outputDepfilePath(file, aprintf("%s%c%s%s.c", options->templateDir,
+        pathSeperator, core->codeIncludeBase, name));
+}
+
+// makefile style dependency list, the generated file depends on every source
+// file parsed and every runtime template referenced by the generated code
+static bool outputDepfile(VMCoreGen* core, CodegenOptions* options,
+    Buffer* file) {
+    CONTEXT(INFO, "Writing depfile %s", options->depfile);
+
+    bufferClear(file);
+    const char* target = options->stamp != NULL ? options->stamp : options->filename;
+    for(const char* c = target; *c != '\0'; c++) {
+        if(*c == ' ' || *c == '#') {
+            bufferPutc(file, '\\');
+        }
+        bufferPutc(file, *c);
+    }
+    bufferPutc(file, ':');
+
+    for(unsigned int i = 0; i < options->sourceCount; i++) {
+        outputDepfilePath(file, options->sources[i]);
+    }
+
+    if(options->templateDir != NULL) {
+        Table seen;
+        initTable(&seen, strHash, strCmp);
+        for(unsigned int i = 0; i < core->headBitCount; i++) {
+            addTemplateDependency(core, options, file, &seen, core->headBits[i]);
+        }
+        for(unsigned int i = 0; i < core->opcodeCount; i++) {
+            GenOpCode* code = &core->opcodes[i];
+            if(!code->isValid) {
+                continue;
+            }
+            for(unsigned int j = 0; j < code->lineCount; j++) {
+                GenOpCodeLine* line = code->lines[j];
                 for(unsigned int k = 0; k < line->highBitCount; k++) {
-                    outputCommand(core, file, line->highBits[k]);
-                }
-                fputs("} else {\n", file);
-                for(unsigned int k = 0; k < line->lowBitCount; k++) {
-                    outputCommand(core, file, line->lowBits[k]);
+                    addTemplateDependency(core, options, file, &seen,
+                        line->highBits[k]);
                 }
-                fputs("}\n", file);
-            } else {
                 for(unsigned int k = 0; k < line->lowBitCount; k++) {
-                    outputCommand(core, file, line->lowBits[k]);
+                    addTemplateDependency(core, options, file, &seen,
+                        line->lowBits[k]);
                 }
             }
         }
-        fputs("break;\n", file);
     }
+    bufferPutc(file, '\n');
 
-    fputs("default: exit(0);\n", file);
-
-    fputs("}\nIP++;\n}}\n", file);
+    return outputFile(file, options->depfile);
 }
 
-void coreCodegen(VMCoreGen* core, const char* filename) {
+bool coreCodegen(VMCoreGen* core, CodegenOptions* options) {
     CONTEXT(INFO, "Running codegen");
-    FILE* file = fopen(filename, "w");
+    MEMORY_TAG(MEMORY_CODEGEN);
 
-    for(unsigned int i = 0; i < core->headers.entryCapacity; i++) {
-        Entry2* entry = &core->headers.entrys[i];
-        const char* header = entry->key.key;
-        if(header == NULL) {
-            continue;
-        }
-        fprintf(file, "#include %s\n", header);
+    CommandCode commandCode;
+    if(!loadCommandCode(core, options, &commandCode)) {
+        return false;
     }
 
-    fputs("void emulator(uint16_t* memory) {\n", file);
-    outputLoop(core, file);
+    Buffer file;
+    bufferInit(&file);
+
+    bool success;
+    if(options->splitCount > 0) {
+        success = outputSplit(core, options, commandCode, &file);
+    } else {
+        outputHeaders(core, &file);
 
-    fputs("#define DEBUG_OUTPUT\n", file);
-    fputs("void emulatorVerbose(uint16_t* memory, FILE* logFile) {\n", file);
-    outputLoop(core, file);
+        bufferPuts(&file, "void emulator(uint16_t* memory) {\n");
+        outputLoop(core, commandCode, &file);
+
+        bufferPuts(&file, "#define DEBUG_OUTPUT\n");
+        bufferPuts(&file, "void emulatorVerbose(uint16_t* memory, FILE* logFile) {\n");
+        outputLoop(core, commandCode, &file);
+
+        success = outputFile(&file, options->filename);
+    }
+
+    if(success && options->depfile != NULL) {
+        success = outputDepfile(core, options, &file);
+    }
+
+    if(success && options->stamp != NULL) {
+        FILE* stamp = fopen(options->stamp, "w");
+        if(stamp == NULL) {
+            cErrPrintf(TextRed, "Could not write stamp file \"%s\"\n",
+                options->stamp);
+            success = false;
+        } else {
+            fclose(stamp);
+        }
+    }
 
-    fclose(file);
+    return success;
 }
@@ -1,8 +1,40 @@
 #ifndef CODEGEN_H
 #define CODEGEN_H
 
+#include <stdbool.h>
 #include "emulator/compiletime/create.h"
 
-void coreCodegen(VMCoreGen* core, const char* filename);
+typedef struct CodegenOptions {
+    // where to write the generated code
+    const char* filename;
+
+    // if non-zero, the opcode handlers are spread across this many additional
+    // files named filename_N.c so they can be compiled in parallel
+    unsigned int splitCount;
+
+    // directory the runtime templates are read from, so their code can be
+    // written into the generated files, and listed as dependencies.  If NULL
+    // the generated code includes the templates instead.
+    const char* templateDir;
+
+    // where to write a makefile style dependency file.  May be NULL.
+    const char* depfile;
+
+    // file updated on every successful run, as the outputs are only written
+    // when they change.  Used as the depfile's target if given.  May be NULL.
+    const char* stamp;
+
+    // directory analysed cores are cached in, so an unchanged input is not
+    // analysed again.  May be NULL.
+    const char* cacheDir;
+
+    // every file the core was parsed from, listed in the depfile
+    const char** sources;
+    unsigned int sourceCount;
+} CodegenOptions;
+
+// write the emulator source for a core.  Output files whose content would not
+// change are left untouched.  Returns false if any file could not be written
+bool coreCodegen(VMCoreGen* core, CodegenOptions* options);
 
 #endif
@@ -0,0 +1,544 @@
+#include "emulator/compiletime/coreCache.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include "shared/platform.h"
+#include "shared/buffer.h"
+#include "shared/table.h"
+#include "shared/log.h"
+#include "microcode/scanner.h"
+#include "microcode/error.h"
+#include "emulator/compiletime/template.h"
+
+// entries store a hash of the executable that wrote them and are rejected by
+// any other build, so a change to the analyser or the entry format never uses
+// a stale entry.  This is also why values can be stored in native byte order
+#define CACHE_MAGIC 0x45524F43u
+
+static void writeU32(Buffer* buf, uint32_t value) {
+    bufferWrite(buf, (const char*)&value, sizeof(value));
+}
+
+static void writeU64(Buffer* buf, uint64_t value) {
+    bufferWrite(buf, (const char*)&value, sizeof(value));
+}
+
+static void writeString(Buffer* buf, const char* str, size_t length) {
+    writeU32(buf, length);
+    bufferWrite(buf, str, length);
+}
+
+static void writeCString(Buffer* buf, const char* str) {
+    writeString(buf, str == NULL ? "" : str, str == NULL ? 0 : strlen(str));
+}
+
+static void writeUIntArray(Buffer* buf, const unsigned int* values,
+    unsigned int count) {
+    writeU32(buf, count);
+    for(unsigned int i = 0; i < count; i++) {
+        writeU32(buf, values[i]);
+    }
+}
+
+// position in an entry being loaded, reading past the end of the entry marks
+// it as failed and returns zeroes
+typedef struct Reader {
+    const char* data;
+    size_t length;
+    size_t position;
+    bool failed;
+} Reader;
+
+static const char* readBytes(Reader* reader, size_t length) {
+    if(reader->failed || reader->length - reader->position < length) {
+        reader->failed = true;
+        return NULL;
+    }
+    const char* bytes = reader->data + reader->position;
+    reader->position += length;
+    return bytes;
+}
+
+static uint32_t readU32(Reader* reader) {
+    uint32_t value = 0;
+    const char* bytes = readBytes(reader, sizeof(value));
+    if(bytes != NULL) {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+static uint64_t readU64(Reader* reader) {
+    uint64_t value = 0;
+    const char* bytes = readBytes(reader, sizeof(value));
+    if(bytes != NULL) {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+// read a string into a new null terminated buffer
+static const char* readString(Reader* reader, unsigned int* length) {
+    uint32_t stringLength = readU32(reader);
+    const char* bytes = readBytes(reader, stringLength);
+    if(bytes == NULL) {
+        return "";
+    }
+
+    char* str = ArenaAlloc(stringLength + 1);
+    memcpy(str, bytes, stringLength);
+    str[stringLength] = '\0';
+    if(length != NULL) {
+        *length = stringLength;
+    }
+    return str;
+}
+
+// read an array written by writeUIntArray into new memory
+static unsigned int* readUIntArray(Reader* reader, unsigned int* count) {
+    *count = readU32(reader);
+    const char* bytes = readBytes(reader, (size_t)*count * sizeof(uint32_t));
+    if(bytes == NULL) {
+        *count = 0;
+        return NULL;
+    }
+
+    unsigned int* values = ArenaAlloc(sizeof(unsigned int) * (*count + 1));
+    for(unsigned int i = 0; i < *count; i++) {
+        uint32_t value;
+        memcpy(&value, bytes + i * sizeof(uint32_t), sizeof(value));
+        values[i] = value;
+    }
+    return values;
+}
+
+// fingerprint of everything createEmulator added to the core, so entries
+// saved with a different template are not used
+static uint64_t templateHash(VMCoreGen* core) {
+    ArenaTemp temp = ArenaTempBegin();
+    Buffer buf;
+    bufferInit(&buf);
+
+    for(unsigned int i = 0; i < core->componentCount; i++) {
+        Component* component = &core->components[i];
+        writeCString(&buf, component->internalName);
+        writeCString(&buf, component->printName);
+        writeU32(&buf, component->type);
+    }
+
+    for(unsigned int i = 0; i < core->commandCount; i++) {
+        Command* command = &core->commands[i];
+        writeCString(&buf, command->name);
+        writeCString(&buf, command->file);
+        writeU32(&buf, command->argsLength);
+        for(unsigned int j = 0; j < command->argsLength; j++) {
+            writeCString(&buf, command->args[j].name);
+            writeCString(&buf, command->args[j].value);
+        }
+        writeUIntArray(&buf, command->depends, command->dependsLength);
+        writeUIntArray(&buf, command->changes, command->changesLength);
+        writeUIntArray(&buf, command->reads, command->readsLength);
+        writeUIntArray(&buf, command->writes, command->writesLength);
+    }
+
+    for(unsigned int i = 0; i < core->variableCount; i++) {
+        writeCString(&buf, core->variables[i]);
+    }
+    for(unsigned int i = 0; i < core->loopVariableCount; i++) {
+        writeCString(&buf, core->loopVariables[i]);
+    }
+    writeCString(&buf, core->codeIncludeBase);
+
+    // the order of the headers in their table is not fixed, so they are
+    // combined in a way that does not depend on it
+    uint64_t headers = 0;
+    for(unsigned int i = 0; i < core->headers.capacity; i++) {
+        const char* header = core->headers.entries[i].key.value;
+        if(header != NULL) {
+            headers += hashBytes(header, strlen(header));
+        }
+    }
+    writeU64(&buf, headers);
+
+    uint64_t hash = hashBytes(buf.chars, buf.charCount);
+    ArenaTempEnd(temp);
+    return hash;
+}
+
+// hash of the running executable, found once as entries are loaded by many
+// threads in test mode
+static pthread_once_t buildHashOnce = PTHREAD_ONCE_INIT;
+static bool buildHashFound = false;
+static uint64_t buildHashValue;
+
+static void findBuildHash() {
+    const char* path = executablePath();
+    FileBuffer executable;
+    if(path == NULL || !mapFile(path, &executable)) {
+        INFO("Could not read the executable, cache disabled");
+        return;
+    }
+    buildHashValue = hashBytes(executable.data, executable.length);
+    buildHashFound = true;
+}
+
+// returns false if the build cannot be identified, so no entry can be trusted
+static bool buildHash(uint64_t* hash) {
+    pthread_once(&buildHashOnce, findBuildHash);
+    *hash = buildHashValue;
+    return buildHashFound;
+}
+
+// one entry for each microcode file, named after its absolute path
+static const char* cachePath(const char* cacheDir, const char* fileName) {
+    const char* path = resolvePath(fileName);
+    return aprintf("%s%c%016llx.core", cacheDir, pathSeperator,
+        (unsigned long long)hashBytes(path, strlen(path)));
+}
+
+static bool hashFile(const char* fileName, FileBuffer* file, uint64_t* hash) {
+    if(!mapFile(fileName, file)) {
+        return false;
+    }
+    *hash = hashBytes(file->data, file->length);
+    return true;
+}
+
+// graph node data can only be printed, so graphs are saved as the text they
+// print, this is where that text is collected
+static _Thread_local Buffer* graphText;
+
+static void printGraphText(TextColor color, const char* format, ...) {
+    (void)color;
+    va_list args;
+    va_start(args, format);
+    bufferVPrintf(graphText, format, args);
+    va_end(args);
+}
+
+static void writeGraph(Buffer* buf, ErrorChunk* chunk) {
+    Graph graph;
+    errBuildGraph(chunk, &graph);
+
+    Buffer text;
+    bufferInit(&text);
+    graphText = &text;
+    printGraph(&graph, printGraphText);
+
+    // printed as a text chunk, which is a format string followed by a newline
+    Buffer escaped;
+    bufferInit(&escaped);
+    size_t length = text.charCount;
+    if(length > 0 && text.chars[length - 1] == '\n') {
+        length--;
+    }
+    for(size_t i = 0; i < length; i++) {
+        if(text.chars[i] == '%') {
+            bufferPutc(&escaped, '%');
+        }
+        bufferPutc(&escaped, text.chars[i]);
+    }
+
+    writeU32(buf, ERROR_CHUNK_TEXT);
+    writeU32(buf, TextWhite);
+    writeString(buf, escaped.chars, escaped.charCount);
+}
+
+static bool writeEntry(Buffer* buf, VMCoreGen* core, Parser* parser, AST* ast) {
+    uint64_t build;
+    if(!buildHash(&build)) {
+        return false;
+    }
+    writeU32(buf, CACHE_MAGIC);
+    writeU64(buf, build);
+    writeU64(buf, templateHash(core));
+
+    writeU32(buf, ast->fileNameCount);
+    for(unsigned int i = 0; i < ast->fileNameCount; i++) {
+        FileBuffer file;
+        uint64_t hash;
+        if(!hashFile(ast->fileNames[i], &file, &hash)) {
+            INFO("Could not read %s", ast->fileNames[i]);
+            return false;
+        }
+        writeCString(buf, ast->fileNames[i]);
+        writeU64(buf, hash);
+    }
+
+    writeUIntArray(buf, core->headBits, core->headBitCount);
+
+    unsigned int validCount = 0;
+    for(unsigned int i = 0; i < core->opcodeCount; i++) {
+        validCount += core->opcodes[i].isValid;
+    }
+    writeU32(buf, core->opcodeCount);
+    writeU32(buf, validCount);
+    for(unsigned int i = 0; i < core->opcodeCount; i++) {
+        GenOpCode* opcode = &core->opcodes[i];
+        if(!opcode->isValid) {
+            continue;
+        }
+
+        writeU32(buf, i);
+        writeString(buf, opcode->name, opcode->nameLen);
+        writeU32(buf, opcode->lineCount);
+        for(unsigned int j = 0; j < opcode->lineCount; j++) {
+            GenOpCodeLine* line = opcode->lines[j];
+            writeU32(buf, line->hasCondition);
+            writeUIntArray(buf, line->lowBits, line->lowBitCount);
+            if(line->hasCondition) {
+                writeUIntArray(buf, line->highBits, line->highBitCount);
+            }
+        }
+    }
+
+    writeU32(buf, parser->errorCount);
+    for(unsigned int i = 0; i < parser->errorCount; i++) {
+        Error* err = parser->errors[i];
+        writeU32(buf, err->level);
+        writeU32(buf, err->severity);
+        writeU32(buf, err->chunkCount);
+        for(unsigned int j = 0; j < err->chunkCount; j++) {
+            ErrorChunk* chunk = &err->chunks[j];
+            switch(chunk->type) {
+                case ERROR_CHUNK_TEXT:
+                    writeU32(buf, ERROR_CHUNK_TEXT);
+                    writeU32(buf, chunk->as.text.color);
+                    writeCString(buf, chunk->as.text.message);
+                    break;
+                case ERROR_CHUNK_SOURCE: {
+                    // sources are saved as the index of the file they are in
+                    SourceRange* range = &chunk->as.source;
+                    unsigned int file = 0;
+                    while(file < ast->fileNameCount &&
+                          strcmp(ast->fileNames[file], range->filename) != 0) {
+                        file++;
+                    }
+                    if(file == ast->fileNameCount) {
+                        INFO("Message refers to unknown file %s",
+                            range->filename);
+                        return false;
+                    }
+                    writeU32(buf, ERROR_CHUNK_SOURCE);
+                    writeU32(buf, file);
+                    writeU32(buf, range->tokenStart - range->sourceStart);
+                    writeU32(buf, range->length);
+                    writeU32(buf, range->line);
+                    writeU32(buf, range->column);
+                    break;
+                }
+                case ERROR_CHUNK_GRAPH:
+                    writeGraph(buf, chunk);
+                    break;
+            }
+        }
+
+        writeU32(buf, err->instanceTotal);
+        writeU32(buf, err->instanceCount);
+        for(unsigned int j = 0; j < err->instanceCount; j++) {
+            writeCString(buf, err->instances[j]);
+        }
+    }
+
+    return true;
+}
+
+bool coreCacheStore(const char* cacheDir, const char* fileName,
+    VMCoreGen* core, Parser* parser, AST* ast) {
+    CONTEXT(INFO, "Saving analysed core of %s", fileName);
+
+    if(parser->hadError) {
+        INFO("Core has errors, not saving");
+        return false;
+    }
+
+    if(!makeDirectory(cacheDir)) {
+        INFO("Could not create cache directory %s", cacheDir);
+        return false;
+    }
+
+    ArenaTemp temp = ArenaTempBegin();
+
+    Buffer buf;
+    bufferInit(&buf);
+    bool result = writeEntry(&buf, core, parser, ast) &&
+        writeFileIfChanged(cachePath(cacheDir, fileName), buf.chars,
+            buf.charCount);
+
+    ArenaTempEnd(temp);
+    return result;
+}
+
+static bool readErrors(Reader* reader, Parser* parser, const char** fileNames,
+    FileBuffer* files, unsigned int fileCount) {
+    unsigned int errorCount = readU32(reader);
+    for(unsigned int i = 0; i < errorCount && !reader->failed; i++) {
+        Error* err = errNew(readU32(reader));
+        err->severity = readU32(reader);
+
+        unsigned int chunkCount = readU32(reader);
+        for(unsigned int j = 0; j < chunkCount && !reader->failed; j++) {
+            unsigned int type = readU32(reader);
+            if(type == ERROR_CHUNK_TEXT) {
+                TextColor color = readU32(reader);
+                errAddText(err, color, "%s", readString(reader, NULL));
+            } else if(type == ERROR_CHUNK_SOURCE) {
+                unsigned int file = readU32(reader);
+                unsigned int offset = readU32(reader);
+                SourceRange range;
+                range.length = readU32(reader);
+                range.line = readU32(reader);
+                range.column = readU32(reader);
+                if(file >= fileCount || offset > files[file].length) {
+                    return false;
+                }
+                range.filename = fileNames[file];
+                range.sourceStart = files[file].data;
+                range.tokenStart = files[file].data + offset;
+                errAddSource(err, &range);
+            } else {
+                return false;
+            }
+        }
+
+        err->instanceTotal = readU32(reader);
+        unsigned int instanceCount = readU32(reader);
+        for(unsigned int j = 0; j < instanceCount && !reader->failed; j++) {
+            errAddInstance(err, readString(reader, NULL));
+        }
+
+        if(err->severity == ERROR_ERROR) {
+            parser->hadError = true;
+        }
+        ARRAY_PUSH(*parser, error, err);
+    }
+
+    return !reader->failed;
+}
+
+static bool readEntry(Reader* reader, VMCoreGen* core, Parser* parser,
+    AST* ast) {
+    uint64_t build;
+    if(!buildHash(&build) || readU32(reader) != CACHE_MAGIC ||
+       readU64(reader) != build) {
+        INFO("Entry is from a different build");
+        return false;
+    }
+
+    createEmulator(core);
+    if(readU64(reader) != templateHash(core)) {
+        INFO("Entry was created with a different template");
+        return false;
+    }
+
+    // every file has to be unchanged, they are kept open as messages print
+    // lines from them
+    unsigned int fileCount = readU32(reader);
+    if(reader->failed || fileCount > reader->length) {
+        return false;
+    }
+    const char** fileNames = ArenaAlloc(sizeof(const char*) * (fileCount + 1));
+    FileBuffer* files = ArenaAlloc(sizeof(FileBuffer) * (fileCount + 1));
+    for(unsigned int i = 0; i < fileCount; i++) {
+        fileNames[i] = readString(reader, NULL);
+        uint64_t savedHash = readU64(reader);
+        uint64_t hash;
+        if(reader->failed || !hashFile(fileNames[i], &files[i], &hash) ||
+           hash != savedHash) {
+            INFO("%s has changed", fileNames[i]);
+            return false;
+        }
+        registerSource(files[i].data, files[i].length);
+    }
+
+    unsigned int headBitCount;
+    unsigned int* headBits = readUIntArray(reader, &headBitCount);
+    for(unsigned int i = 0; i < headBitCount; i++) {
+        ARRAY_PUSH(*core, headBit, headBits[i]);
+    }
+
+    unsigned int opcodeCount = readU32(reader);
+    unsigned int validCount = readU32(reader);
+    if(reader->failed || validCount > opcodeCount) {
+        return false;
+    }
+    if(opcodeCount > 0) {
+        core->opcodeCount = opcodeCount;
+        core->opcodes = ArenaAlloc(sizeof(GenOpCode) * opcodeCount);
+        for(unsigned int i = 0; i < opcodeCount; i++) {
+            core->opcodes[i].isValid = false;
+        }
+    }
+
+    for(unsigned int i = 0; i < validCount && !reader->failed; i++) {
+        unsigned int id = readU32(reader);
+        if(id >= opcodeCount) {
+            return false;
+        }
+
+        GenOpCode* opcode = &core->opcodes[id];
+        opcode->id = id;
+        opcode->isValid = true;
+        opcode->name = readString(reader, &opcode->nameLen);
+        ARRAY_ALLOC(GenOpCodeLine*, *opcode, line);
+
+        unsigned int lineCount = readU32(reader);
+        for(unsigned int j = 0; j < lineCount && !reader->failed; j++) {
+            GenOpCodeLine* line = ArenaAlloc(sizeof(GenOpCodeLine));
+            line->hasCondition = readU32(reader);
+            line->lowBits = readUIntArray(reader, &line->lowBitCount);
+            line->lowBitCapacity = line->lowBitCount;
+            line->lowBitElementSize = sizeof(unsigned int);
+            if(line->hasCondition) {
+                line->highBits = readUIntArray(reader, &line->highBitCount);
+                line->highBitCapacity = line->highBitCount;
+                line->highBitElementSize = sizeof(unsigned int);
+            } else {
+                line->highBits = line->lowBits;
+                line->highBitCount = line->lowBitCount;
+                line->highBitCapacity = line->lowBitCapacity;
+                line->highBitElementSize = line->lowBitElementSize;
+            }
+            ARRAY_PUSH(*opcode, line, line);
+        }
+    }
+
+    parser->scanner = NULL;
+    parser->hadError = false;
+    parser->panicMode = false;
+    ARRAY_ALLOC(bool, *parser, errorStack);
+    ARRAY_ALLOC(Error*, *parser, error);
+    parser->ast = ast;
+    if(!readErrors(reader, parser, fileNames, files, fileCount) ||
+       reader->position != reader->length) {
+        return false;
+    }
+
+    for(unsigned int i = 0; i < fileCount; i++) {
+        ARRAY_PUSH(*ast, fileName, fileNames[i]);
+    }
+    return true;
+}
+
+bool coreCacheLoad(const char* cacheDir, const char* fileName,
+    VMCoreGen* core, Parser* parser, AST* ast) {
+    CONTEXT(INFO, "Loading analysed core of %s", fileName);
+    MEMORY_TAG(MEMORY_ANALYSIS);
+
+    FileBuffer entry;
+    if(!mapFile(cachePath(cacheDir, fileName), &entry)) {
+        INFO("No cache entry");
+        return false;
+    }
+
+    Reader reader = {entry.data, entry.length, 0, false};
+    if(!readEntry(&reader, core, parser, ast)) {
+        INFO("Cache entry is out of date");
+        return false;
+    }
+
+    INFO("Loaded cached core");
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef CORE_CACHE_H
+#define CORE_CACHE_H
+
+#include <stdbool.h>
+#include "emulator/compiletime/create.h"
+#include "microcode/parser.h"
+#include "microcode/ast.h"
+
+// Analysed cores are saved in a cache directory, one file per microcode file,
+// so an unchanged microcode file does not have to be parsed and analysed
+// again.  An entry is only used if it was saved by the same executable and
+// the template core and the content of every file parsed are the same as when
+// it was saved.
+
+// load the analysed core of a microcode file.  Fills in the core, the ast's
+// file list and the warnings emitted in the parser, but no statements.
+// returns false if there is no up to date entry
+bool coreCacheLoad(const char* cacheDir, const char* fileName,
+    VMCoreGen* core, Parser* parser, AST* ast);
+
+// save the analysed core of a microcode file, cores with errors are not saved.
+// returns false if the entry could not be written
+bool coreCacheStore(const char* cacheDir, const char* fileName,
+    VMCoreGen* core, Parser* parser, AST* ast);
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 #include "shared/platform.h"
 #include "shared/log.h"
 
@@ -24,7 +25,13 @@ void initCore(VMCoreGen* core) {
     core->opcodes = NULL;
     core->opcodeCount = 0;
 
-    TABLE2_INIT(core->headers, hashstr, cmpstr, const char*, int);
+    core->componentWords = 0;
+    core->dependsMask = NULL;
+    core->changesMask = NULL;
+    core->readsMask = NULL;
+    core->writesMask = NULL;
+
+    initTable(&core->headers, strHash, strCmp);
     core->codeIncludeBase = "emulator/runtime/";
     addHeader(core, "<stdbool.h>");
 }
@@ -63,8 +70,43 @@ void addCommand(VMCoreGen* core, Command command) {
     ARRAY_PUSH(*core, command, command);
 }
 
+static uint64_t* allocMasks(VMCoreGen* core) {
+    size_t size = sizeof(uint64_t) * core->componentWords * core->commandCount;
+    uint64_t* masks = ArenaAlloc(size);
+    memset(masks, 0, size);
+    return masks;
+}
+
+static void setMask(uint64_t* mask, unsigned int* components, unsigned int count) {
+    for(unsigned int i = 0; i < count; i++) {
+        mask[components[i] / 64] |= (uint64_t)1 << (components[i] % 64);
+    }
+}
+
+void buildCommandMasks(VMCoreGen* core) {
+    CONTEXT(INFO, "Building command masks");
+
+    core->componentWords = (core->componentCount + 63) / 64;
+    core->dependsMask = allocMasks(core);
+    core->changesMask = allocMasks(core);
+    core->readsMask = allocMasks(core);
+    core->writesMask = allocMasks(core);
+
+    for(unsigned int i = 0; i < core->commandCount; i++) {
+        Command* command = &core->commands[i];
+        setMask(COMMAND_MASK(core, depends, i), command->depends,
+            command->dependsLength);
+        setMask(COMMAND_MASK(core, changes, i), command->changes,
+            command->changesLength);
+        setMask(COMMAND_MASK(core, reads, i), command->reads,
+            command->readsLength);
+        setMask(COMMAND_MASK(core, writes, i), command->writes,
+            command->writesLength);
+    }
+}
+
 void addHeader(VMCoreGen* core, const char* header) {
-    TABLE2_SET(core->headers, header, 1);
+    tableSet(&core->headers, (void*)header, (void*)1);
 }
 
 void addVariable(VMCoreGen* core, const char* format, ...) {
@@ -1,8 +1,9 @@
 #ifndef VM_CORE_GEN_H
 #define VM_CORE_GEN_H
 
+#include <stdint.h>
 #include "shared/memory.h"
-#include "shared/table2.h"
+#include "shared/table.h"
 
 typedef struct Argument {
     const char* name;
@@ -50,7 +51,7 @@ typedef enum ComponentType {
     FOREACH_COMPONENT(ENUM_COMPONENT)
 } ComponentType;
 
-const char* ComponentTypeNames[FOREACH_COMPONENT(ADD_COMPONENT)];
+extern const char* ComponentTypeNames[FOREACH_COMPONENT(ADD_COMPONENT)];
 
 #undef ENUM_COMPONENT
 #undef ADD_COMPONENT
@@ -59,19 +60,25 @@ typedef struct Component {
     const char* internalName;
     const char* printName;
     ComponentType type;
-
-    bool busStatus;
 } Component;
 
 typedef struct VMCoreGen {
     ARRAY_DEFINE(Component, component);
 
-    Table2 headers;
+    Table headers;
     ARRAY_DEFINE(const char*, variable);
     ARRAY_DEFINE(const char*, loopVariable);
 
     ARRAY_DEFINE(Command, command);
 
+    // per command bitmasks of component ids, componentWords words for each
+    // command, filled in by buildCommandMasks
+    unsigned int componentWords;
+    uint64_t* dependsMask;
+    uint64_t* changesMask;
+    uint64_t* readsMask;
+    uint64_t* writesMask;
+
     GenOpCode* opcodes;
     unsigned int opcodeCount;
 
@@ -103,6 +110,14 @@ void addMemoryBusOutput(VMCoreGen* core, Memory* mem, unsigned int bus);
 
 void addCommand(VMCoreGen* core, Command command);
 
+// precompute the component bitmasks of every command, must be called after
+// all components and commands have been added
+void buildCommandMasks(VMCoreGen* core);
+
+// get the bitmask for a command from one of the core's mask arrays
+#define COMMAND_MASK(core, mask, command) \
+    ((core)->mask##Mask + (size_t)(command) * (core)->componentWords)
+
 unsigned int* AllocUInt(unsigned int itemCount, ...);
 Argument* AllocArgument(unsigned int itemCount, ...);
 
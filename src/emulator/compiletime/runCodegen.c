@@ -1,6 +1,7 @@
 #include "emulator/compiletime/runCodegen.h"
 
 #include "shared/platform.h"
+#include "shared/timeReport.h"
 #include "microcode/scanner.h"
 #include "microcode/parser.h"
 #include "microcode/analyse.h"
@@ -8,26 +9,62 @@
 #include "emulator/compiletime/create.h"
 #include "emulator/compiletime/template.h"
 #include "emulator/compiletime/codegen.h"
+#include "emulator/compiletime/coreCache.h"
 
-int runCodegen(const char* in, const char* out) {
-    Scanner scan;
-    ScannerInit(&scan, readFile(in), in);
-
+int runCodegen(const char* in, CodegenOptions* options) {
     Parser parse;
     AST ast;
     InitAST(&ast);
+    VMCoreGen core;
 
-    Parse(&parse, &scan, &ast);
+    StageTimer timer = stageBegin();
+    if(options->cacheDir != NULL &&
+       coreCacheLoad(options->cacheDir, in, &core, &parse, &ast)) {
+        stageEnd(&timer, "cache", 1, "files");
+    } else {
+        FileBuffer source;
+        if(!mapFile(in, &source)) {
+            cErrPrintf(TextRed, "Could not read file \"%s\"\n", in);
+            return 1;
+        }
 
-    VMCoreGen core;
-    createEmulator(&core);
-    Analyse(&parse, &core);
+        Scanner scan;
+        ScannerInit(&scan, source.data, source.length, in);
+
+        if(timeReportEnabled()) {
+            unsigned int tokens = ScannerCountTokens(&scan);
+            stageEnd(&timer, "scan", tokens, "tokens");
+        }
+
+        timer = stageBegin();
+        Parse(&parse, &scan, &ast);
+        stageEnd(&timer, "parse", ast.statementCount, "statements");
+
+        timer = stageBegin();
+        createEmulator(&core);
+        stageEnd(&timer, "template", core.commandCount, "commands");
+
+        Analyse(&parse, &core);
+
+        if(options->cacheDir != NULL) {
+            coreCacheStore(options->cacheDir, in, &core, &parse, &ast);
+        }
+    }
     printErrors(&parse);
 
     if(parse.hadError) {
         return 1;
-    } else {
-        coreCodegen(&core, out);
-        return 0;
     }
+
+    options->sources = ast.fileNames;
+    options->sourceCount = ast.fileNameCount;
+    unsigned int opcodes = 0;
+    for(unsigned int i = 0; i < core.opcodeCount; i++) {
+        opcodes += core.opcodes[i].isValid;
+    }
+
+    timer = stageBegin();
+    bool success = coreCodegen(&core, options);
+    stageEnd(&timer, "codegen", opcodes, "opcodes");
+    return success ? 0 : 1;
 }
\ No newline at end of file
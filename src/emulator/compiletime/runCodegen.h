@@ -1,6 +1,10 @@
 #ifndef RUNCODEGEN_H
 #define RUNCODEGEN_H
 
-int runCodegen();
+#include "emulator/compiletime/codegen.h"
+
+// parse and analyse the microcode file in, then generate code for it.
+// the options' source list is filled in from the files parsed
+int runCodegen(const char* in, CodegenOptions* options);
 
 #endif
\ No newline at end of file
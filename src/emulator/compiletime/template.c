@@ -44,4 +44,6 @@ void createEmulator(VMCoreGen* core) {
     //addConditionRegister(core);
 
     addHaltInstruction(core);
+
+    buildCommandMasks(core);
 }
@@ -3,10 +3,28 @@
 #include "shared/memory.h"
 #include "shared/arg.h"
 #include "shared/log.h"
+#include "shared/thread.h"
+#include "shared/profile.h"
+#include "shared/timeReport.h"
 #include "microcode/test.h"
+#include "microcode/bench.h"
 #include "emulator/runtime/emu.h"
 #include "emulator/compiletime/runCodegen.h"
 
+// report anything requested once a mode has run, then close the log
+static int finish(bool memStats, const char* profile, int result) {
+    timeReportPrint();
+    if(profile != NULL) {
+        if(!profileWrite(profile)) {
+            cErrPrintf(TextRed, "Could not write profile \"%s\"\n", profile);
+        }
+        profilePrintStats(true);
+    }
+    MemoryPrintStats(memStats);
+    logClose();
+    return result;
+}
+
 int main(int argc, char** argv){
     if(!logInit()) return -1;
     startColor();
@@ -22,7 +40,7 @@ int main(int argc, char** argv){
     optionArg* disableColor = argUniversalOption(&parser, 'c', "no-color", true);
     disableColor->helpMessage = "disable color output";
     optionArg* logFile = argUniversalOptionString(&parser, 'l', "log-file", false);
-    logFile->helpMessage = "File name to write logging to.  Default is tempfile voided on program close.";
+    logFile->helpMessage = "File name to write logging to.  Default is no log, only internal warnings are counted.";
     optionArg* logLevel = argUniversalOptionInt(&parser, 'd', "debug-level", false);
     logLevel->helpMessage = "Minimum level of importance for log messages to be written. "
         "Fatal is 1000, error is 800, warn is 600, info is 400, debug is 200, trace is 0. "
@@ -32,11 +50,55 @@ int main(int argc, char** argv){
         "Default value is undefined, \"stdout\" is stdout and \"stderr\" is "
         "stderr.  Useful so errors are not mixed with output from make.  Does "
         "not apply to anything printed from the argument parser.";
+    optionArg* jobs = argUniversalOptionInt(&parser, 'j', "jobs", true);
+    jobs->helpMessage = "Number of threads to use for analysis.  Default value "
+        "is 1, 0 uses one thread per processor.";
+    optionArg* cacheDir = argUniversalOptionString(&parser, '\0', "cache", true);
+    cacheDir->argumentName = "path";
+    cacheDir->helpMessage = "Directory to save analysed microcode in, so "
+        "unchanged files are not analysed again.  Default is no cache.";
+    optionArg* profile = argUniversalOptionString(&parser, '\0', "profile", true);
+    profile->argumentName = "path";
+    profile->helpMessage = "Time every logging context and write them to this "
+        "file as a Chrome trace, then print the time spent in each context.";
+    optionArg* memStats = argUniversalOption(&parser, '\0', "mem-stats", true);
+    memStats->helpMessage = "Print how much memory each part of the program "
+        "used on exit.  Always written to the log.";
 
     argParser* analyse = argMode(&parser, "analyse");
-    analyse->helpMessage = "Parse and analyse a microcode description file";
-    posArg* microcode = argString(analyse, "file");
-    microcode->helpMessage = "microcode description file to be parsed";
+    analyse->helpMessage = "Parse and analyse microcode description files";
+    posArg* microcode = argStringList(analyse, "file");
+    microcode->helpMessage = "microcode description files to be parsed, every "
+        ".uasm file is parsed for directories";
+    optionArg* analyseTimeReport = argOption(analyse, '\0', "time-report");
+    analyseTimeReport->helpMessage = "Print the time, memory and work taken "
+        "by each stage of the analysis, and by the slowest opcodes.";
+
+    argParser* test = argMode(&parser, "test");
+    test->helpMessage = "Run microcode test files, checking each produces the "
+        "messages it expects";
+    posArg* testPaths = argStringList(test, "path");
+    testPaths->helpMessage = "test files to run, every .uasmt file is run for "
+        "directories";
+    optionArg* testBless = argOption(test, '\0', "bless");
+    testBless->helpMessage = "Replace the expected messages of failing tests "
+        "with the messages they produced.";
+    optionArg* testSlowest = argOptionInt(test, '\0', "slowest");
+    testSlowest->helpMessage = "Number of the slowest tests to list.  Default "
+        "value is 5.";
+
+    argParser* scannerBench = argMode(&parser, "scanner-bench");
+    scannerBench->helpMessage = "Measure how quickly microcode can be scanned";
+    optionArg* benchFile = argOptionString(scannerBench, '\0', "file");
+    benchFile->argumentName = "path";
+    benchFile->helpMessage = "Microcode file to scan.  Default is a generated "
+        "file, sized by --size.";
+    optionArg* benchSize = argOptionInt(scannerBench, '\0', "size");
+    benchSize->helpMessage = "Size in MB of the generated file.  Default "
+        "value is 64.";
+    optionArg* benchRepeat = argOptionInt(scannerBench, '\0', "repeat");
+    benchRepeat->helpMessage = "Number of times to scan the file, the fastest "
+        "is reported.  Default value is 5.";
 
 #if BUILD_STAGE > 0
     argParser* vm = argMode(&parser, "vm");
@@ -57,6 +119,27 @@ int main(int argc, char** argv){
     codegenInput->helpMessage = "Input microcode file to generate code for";
     posArg* codegenOutput = argString(codegen, "file");
     codegenOutput->helpMessage = "Where to write the generated code";
+    optionArg* codegenSplit = argOptionInt(codegen, '\0', "split");
+    codegenSplit->helpMessage = "Spread the opcode handlers across this many "
+        "extra files named after the output file, so they can be compiled in "
+        "parallel.  Default value is 0, everything is written to one file.";
+    optionArg* codegenDepfile = argOptionString(codegen, '\0', "depfile");
+    codegenDepfile->argumentName = "path";
+    codegenDepfile->helpMessage = "Write a makefile style list of the files "
+        "the generated code depends on to this file.";
+    optionArg* codegenStamp = argOptionString(codegen, '\0', "stamp");
+    codegenStamp->argumentName = "path";
+    codegenStamp->helpMessage = "Touch this file after every successful run, "
+        "generated files are only written if their content changes.";
+    optionArg* codegenTemplateDir = argOptionString(codegen, '\0', "template-dir");
+    codegenTemplateDir->argumentName = "path";
+    codegenTemplateDir->helpMessage = "Directory the vm runtime templates are "
+        "read from.  The templates are copied into the generated code rather "
+        "than included, and are listed in the depfile.";
+    optionArg* codegenTimeReport = argOption(codegen, '\0', "time-report");
+    codegenTimeReport->helpMessage = "Print the time, memory and work taken "
+        "by each stage of the analysis and code generation, and by the "
+        "slowest opcodes.";
 #endif
 
     argArguments(&parser, argc, argv);
@@ -94,32 +177,94 @@ int main(int argc, char** argv){
             logClose();
             return 1;
         }
+    } else {
+        logSetFile(NULL);
     }
 
     if(disableColor->found) {
         EnableColor = false;
     }
 
+    if(jobs->found) {
+        if(jobs->value.as_int < 0) {
+            cErrPrintf(TextRed, "Cannot use a negative number of jobs\n");
+            logClose();
+            return 1;
+        }
+        threadSetCount(jobs->value.as_int);
+    }
+
+    if(profile->found) {
+        profileStart();
+    }
+
+    if(analyseTimeReport->found) {
+        timeReportStart();
+    }
+#if BUILD_STAGE == 0 || DEBUG_BUILD
+    if(codegenTimeReport->found) {
+        timeReportStart();
+    }
+#endif
+
 #if BUILD_STAGE > 0
     if(vm->parsed) {
         runEmulator(strArg(*vm, 0), vmVerbose->found, vmLogFile->value.as_string);
-        logClose();
-        return 0;
+        return finish(memStats->found, profile->value.as_string, 0);
     }
 #endif
 
 #if BUILD_STAGE == 0 || DEBUG_BUILD
     if(codegen->parsed) {
-        int result = runCodegen(strArg(*codegen, 0), strArg(*codegen, 1));
-        logClose();
-        return result;
+        if(codegenSplit->found && codegenSplit->value.as_int < 0) {
+            cErrPrintf(TextRed, "Cannot split generated code into a negative "
+                "number of files\n");
+            logClose();
+            return 1;
+        }
+        CodegenOptions options = {
+            .filename = strArg(*codegen, 1),
+            .splitCount = codegenSplit->found ? codegenSplit->value.as_int : 0,
+            .depfile = codegenDepfile->value.as_string,
+            .stamp = codegenStamp->value.as_string,
+            .templateDir = codegenTemplateDir->value.as_string,
+            .cacheDir = cacheDir->value.as_string
+        };
+        int result = runCodegen(strArg(*codegen, 0), &options);
+        return finish(memStats->found, profile->value.as_string, result);
     }
 #endif
 
+    if(scannerBench->parsed) {
+        if((benchSize->found && benchSize->value.as_int < 0) ||
+           (benchRepeat->found && benchRepeat->value.as_int < 1)) {
+            cErrPrintf(TextRed, "Benchmark size cannot be negative and at "
+                "least one run is required\n");
+            logClose();
+            return 1;
+        }
+        bool result = !runScannerBench(benchFile->value.as_string,
+            benchSize->found ? benchSize->value.as_int : 64,
+            benchRepeat->found ? benchRepeat->value.as_int : 5);
+        return finish(memStats->found, profile->value.as_string, result);
+    }
+
+    if(test->parsed) {
+        if(testSlowest->found && testSlowest->value.as_int < 0) {
+            cErrPrintf(TextRed, "Cannot list a negative number of tests\n");
+            logClose();
+            return 1;
+        }
+        bool result = !runTests((const char**)testPaths->strings,
+            testPaths->stringCount, testBless->found,
+            testSlowest->found ? testSlowest->value.as_int : 5);
+        return finish(memStats->found, profile->value.as_string, result);
+    }
+
     if(analyse->parsed) {
-        bool result = !runFileName(strArg(*analyse, 0));
-        logClose();
-        return result;
+        bool result = !runFileNames((const char**)microcode->strings,
+            microcode->stringCount, cacheDir->value.as_string);
+        return finish(memStats->found, profile->value.as_string, result);
     }
 
     parser.success = false;
@@ -5,6 +5,9 @@
 #include "shared/memory.h"
 #include "shared/graph.h"
 #include "shared/log.h"
+#include "shared/thread.h"
+#include "shared/intern.h"
+#include "shared/timeReport.h"
 #include "emulator/compiletime/create.h"
 #include "microcode/token.h"
 #include "microcode/ast.h"
@@ -27,9 +30,11 @@ static Identifier* getParameter(Parser* parser, Token* errPoint, char* name,
     char* usage, AnalysisState* state)
 {
     if(!state->erroredParametersInitialized) {
-        initTable(&state->erroredParameters, strHash, strCmp);
+        initTable(&state->erroredParameters, atomHash, atomCmp);
     }
 
+    name = (char*)intern(name);
+
     if(tableHas(&state->erroredParameters, name)) {
         return NULL;
     }
@@ -190,41 +195,166 @@ static void analyseHeader(Parser* parser, ASTStatement* s, VMCoreGen* core, Anal
             continue;
         }
 
-        NodeArray nodes = analyseLine(core, parser, line,
+        LineAnalysis* result = analyseLine(core, parser, line,
             &s->as.header.range, state);
-        for(unsigned int j = 0; j < nodes.nodeCount; j++) {
-            ARRAY_PUSH(*core, headBit, nodes.nodes[j]->value);
+        for(unsigned int j = 0; j < result->commandCount; j++) {
+            ARRAY_PUSH(*core, headBit, result->commands[j]);
+        }
+    }
+}
+
+// shared data for analysing every possibility of one opcode
+typedef struct PossibilityJob {
+    Parser* parser;
+    VMCoreGen* core;
+    ASTStatementOpcode* opcode;
+    AnalysisState* state;
+    unsigned int opcodeID;
+
+    // errors emitted while analysing each possibility
+    Parser* results;
+} PossibilityJob;
+
+// generate the lines of a single possibility of an opcode.  Can be run on any
+// thread, only writes to the possibility's own opcode and error list
+static void analysePossibility(void* data, unsigned int possibility) {
+    CONTEXT(INFO, "Analysing opcode possibility %u", possibility);
+    MEMORY_TAG(MEMORY_ANALYSIS);
+
+    PossibilityJob* job = data;
+    VMCoreGen* core = job->core;
+    ASTStatementOpcode* opcode = job->opcode;
+    AnalysisState* state = job->state;
+    unsigned int opcodeID = job->opcodeID;
+
+    Parser* parser = &job->results[possibility];
+    *parser = *job->parser;
+    ARRAY_ALLOC(struct Error*, *parser, error);
+    parser->hadError = false;
+    parser->errorStackCount = 0;
+
+    bool errored = false;
+    GenOpCode* gencode = &core->opcodes[opcodeID+possibility];
+    gencode->isValid = true;
+    gencode->id = opcodeID+possibility;
+    gencode->name = opcode->name.range.tokenStart;
+    gencode->nameLen = opcode->name.range.length;
+    ARRAY_ALLOC(GenOpCodeLine*, *gencode, line);
+
+    for(unsigned int j = 0; j < opcode->lineCount; j++) {
+        ASTMicrocodeLine* line = opcode->lines[j];
+        GenOpCodeLine* genline = ArenaAlloc(sizeof(GenOpCodeLine));
+        ARRAY_ALLOC(unsigned int, *genline, lowBit);
+        genline->hasCondition = line->hasCondition;
+        if(line->hasCondition) {
+            ARRAY_ALLOC(unsigned int, *genline, highBit);
+        }
+
+        // the graphs and arrays created to analyse the line are only needed
+        // until the bits have been copied to the opcode
+        ArenaTemp temp = ArenaTempBegin();
+
+        LineAnalysis* low = substituteAnalyseLine(&line->bitsLow, core, parser, opcode, possibility, j, state);
+        if(!low->ordered) {
+            WARN("Leaving opcode analysis due to errors");
+            ArenaTempEnd(temp);
+            errored = true;
+            break;
+        }
+
+        LineAnalysis* high = low;
+        if(line->hasCondition) {
+            high = substituteAnalyseLine(&line->bitsHigh, core, parser, opcode, possibility, j, state);
+            if(!high->ordered) {
+                WARN("Leaving opcode analysis due to errors");
+                ArenaTempEnd(temp);
+                errored = true;
+                break;
+            }
         }
+
+        {
+            ARENA_PERSISTENT();
+            for(unsigned int k = 0; k < low->commandCount; k++) {
+                TRACE("Emitting %u at %u", low->commands[k], opcodeID+possibility);
+                ARRAY_PUSH(*genline, lowBit, low->commands[k]);
+            }
+            if(line->hasCondition) {
+                for(unsigned int k = 0; k < high->commandCount; k++) {
+                    ARRAY_PUSH(*genline, highBit, high->commands[k]);
+                }
+            }
+        }
+        ArenaTempEnd(temp);
+
+        if(!line->hasCondition) {
+            genline->highBits = genline->lowBits;
+            genline->highBitCount = genline->lowBitCount;
+            genline->highBitCapacity = genline->lowBitCapacity;
+        }
+
+        ARRAY_PUSH(*gencode, line, genline);
+    }
+
+    if(errored) {
+        gencode->isValid = false;
+    }
+}
+
+// the opcode's name followed by the member chosen for each parameter
+static const char* describePossibility(ASTStatementOpcode* opcode,
+    unsigned int possibility, AnalysisState* state) {
+    ARENA_PERSISTENT();
+    MEMORY_TAG(MEMORY_ERROR);
+
+    // the last parameter changes fastest, as in substituteAnalyseLine
+    const char* members[opcode->paramCount + 1];
+    for(int i = opcode->paramCount - 1; i >= 0; i--) {
+        Identifier* paramType;
+        tableGet(&state->identifiers, (char*)opcode->params[i].name.data.string,
+            (void**)&paramType);
+        IdentifierEnum* enumType = &paramType->as.userType.as.enumType;
+        members[i] = enumType->members[possibility % enumType->memberCount]
+            ->data.string;
+        possibility /= enumType->memberCount;
+    }
+
+    const char* description = aprintf("%.*s", opcode->name.range.length,
+        opcode->name.range.tokenStart);
+    for(unsigned int i = 0; i < opcode->paramCount; i++) {
+        description = aprintf("%s %s=%s", description,
+            opcode->params[i].value.data.string, members[i]);
     }
+    return description;
 }
 
-static void analyseOpcode(Parser* parser, ASTStatement* s, VMCoreGen* core, AnalysisState* state) {
+// returns the number of possibilities analysed
+static unsigned int analyseOpcode(Parser* parser, ASTStatement* s, VMCoreGen* core, AnalysisState* state) {
     CONTEXT(INFO, "Analysing opcode statement");
 
     ASTStatementOpcode *opcode = &s->as.opcode;
 
-    static bool notParsedHeaderThrown = false;
     if(!state->parsedHeader) {
-        if(!notParsedHeaderThrown) {
+        if(!state->notParsedHeaderThrown) {
             Error* err = errNew(ERROR_SEMANTIC);
             errAddText(err, TextRed, "To parse an opcode, the header must be "
                 "defined");
             errAddSource(err, &opcode->range);
             errEmit(err, parser);
         }
-        notParsedHeaderThrown = true;
-        return;
+        state->notParsedHeaderThrown = true;
+        return 0;
     }
 
     Identifier* phase = getParameter(parser, &opcode->name,
         "phase", "opcode", state);
-    if(phase == NULL) return;
+    if(phase == NULL) return 0;
     unsigned int maxLines = (1 << phase->as.parameter.value) -
         state->firstHeader->as.header.lineCount;
 
     Identifier* opsize = getParameter(parser, &opcode->name,
         "opsize", "opcode", state);
-    if(opsize == NULL) return;
+    if(opsize == NULL) return 0;
     unsigned int maxHeaderBitLength = opsize->as.parameter.value;
 
     if(core->opcodes == NULL) {
@@ -275,7 +405,7 @@ static void analyseOpcode(Parser* parser, ASTStatement* s, VMCoreGen* core, Anal
     }
 
     if(!passed) {
-        return;
+        return 0;
     }
 
     if(headerBitLength > maxHeaderBitLength) {
@@ -284,7 +414,7 @@ static void analyseOpcode(Parser* parser, ASTStatement* s, VMCoreGen* core, Anal
             "%u, expected %u", headerBitLength, maxHeaderBitLength);
         errAddSource(err, &opcode->id.range);
         errEmit(err, parser);
-        return;
+        return 0;
     }
     if(headerBitLength < maxHeaderBitLength) {
         Error* err = errNew(ERROR_SEMANTIC);
@@ -292,7 +422,7 @@ static void analyseOpcode(Parser* parser, ASTStatement* s, VMCoreGen* core, Anal
             "found %u, expected %u", headerBitLength, maxHeaderBitLength);
         errAddSource(err, &opcode->id.range);
         errEmit(err, parser);
-        return;
+        return 0;
     }
 
     if(opcode->lineCount > maxLines) {
@@ -301,7 +431,7 @@ static void analyseOpcode(Parser* parser, ASTStatement* s, VMCoreGen* core, Anal
             headerBitLength, maxHeaderBitLength);
         errAddSource(err, &opcode->name.range);
         errEmit(err, parser);
-        return;
+        return 0;
     }
 
     for(unsigned int i = 0; i < opcode->lineCount; i++) {
@@ -327,59 +457,42 @@ static void analyseOpcode(Parser* parser, ASTStatement* s, VMCoreGen* core, Anal
     }
 
     if(!passed) {
-        return;
-    }
-
-    for(unsigned int possibility = 0; possibility < possibilities; possibility++) {
-        bool errored = false;
-        GenOpCode* gencode = &core->opcodes[opcodeID+possibility];
-        gencode->isValid = true;
-        gencode->id = opcodeID+possibility;
-        gencode->name = opcode->name.range.tokenStart;
-        gencode->nameLen = opcode->name.range.length;
-        ARRAY_ALLOC(GenOpCodeLine*, *gencode, line);
-
-        for(unsigned int j = 0; j < opcode->lineCount; j++) {
-            ASTMicrocodeLine* line = opcode->lines[j];
-            GenOpCodeLine* genline = ArenaAlloc(sizeof(GenOpCodeLine));
-            ARRAY_ALLOC(unsigned int, *genline, lowBit);
-            genline->hasCondition = line->hasCondition;
-
-            NodeArray low = substituteAnalyseLine(&line->bitsLow, core, parser, opcode, possibility, j, state);
-            if(!low.validArray) {
-                WARN("Leaving opcode analysis due to errors");
-                errored = true;
-                break;
-            }
-            for(unsigned int k = 0; k < low.nodeCount; k++) {
-                TRACE("Emitting %u at %u", low.nodes[k]->value, opcodeID+possibility);
-                ARRAY_PUSH(*genline, lowBit, low.nodes[k]->value);
-            }
-
-            if(line->hasCondition) {
-                ARRAY_ALLOC(unsigned int, *genline, highBit);
-                NodeArray high = substituteAnalyseLine(&line->bitsHigh, core, parser, opcode, possibility, j, state);
-                if(!high.validArray) {
-                    WARN("Leaving opcode analysis due to errors");
-                    errored = true;
-                    break;
-                }
-                for(unsigned int k = 0; k < high.nodeCount; k++) {
-                    ARRAY_PUSH(*genline, highBit, high.nodes[k]->value);
-                }
-            } else {
-                genline->highBits = genline->lowBits;
-                genline->highBitCount = genline->lowBitCount;
-                genline->highBitCapacity = genline->lowBitCapacity;
+        return 0;
+    }
+
+    // every possibility is independent, so they are analysed in parallel with
+    // errors collected per possibility then merged in order so the output does
+    // not depend on the number of threads
+    PossibilityJob job = {
+        .parser = parser,
+        .core = core,
+        .opcode = opcode,
+        .state = state,
+        .opcodeID = opcodeID,
+        .results = ArenaAlloc(sizeof(Parser) * possibilities)
+    };
+    parallelFor(possibilities, analysePossibility, &job);
+
+    // possibilities often share a problem, which is reported once
+    ErrorSet errors;
+    errSetInit(&errors, parser);
+    bool hadError = false;
+    for(unsigned int i = 0; i < possibilities; i++) {
+        Parser* result = &job.results[i];
+        if(result->errorCount > 0) {
+            const char* description = describePossibility(opcode, i, state);
+            for(unsigned int j = 0; j < result->errorCount; j++) {
+                errSetAdd(&errors, result->errors[j], i, description);
             }
-
-            ARRAY_PUSH(*gencode, line, genline);
-        }
-
-        if(errored) {
-            gencode->isValid = false;
         }
+        hadError |= result->hadError;
     }
+    if(hadError) {
+        parser->hadError = true;
+        setErrorState(parser);
+    }
+
+    return possibilities;
 }
 
 static void analyseEnum(Parser* parser, ASTStatement* s, AnalysisState* state) {
@@ -569,11 +682,11 @@ static void analyseBitgroup(Parser* parser, ASTStatement* s, AnalysisState* stat
         }
     }
 
-    // list of null terminated strings
-    char* substitutedList =
-        ArenaAlloc(sizeof(char) * lineLength * possibilities);
+    // each substitution is built in currentIdent then interned
+    const char** substitutedList =
+        ArenaAlloc(sizeof(const char*) * possibilities);
+    char currentIdent[lineLength];
     for(unsigned int i = 0; i < possibilities; i++) {
-        char* currentIdent = &substitutedList[i*lineLength];
         currentIdent[0] = '\0';
 
         unsigned int count = 0;
@@ -601,8 +714,9 @@ static void analyseBitgroup(Parser* parser, ASTStatement* s, AnalysisState* stat
 
         // check that after the substitutions have completed, a valid
         // control bit was formed
+        substitutedList[i] = intern(currentIdent);
         Identifier* val;
-        if(!tableGet(&state->identifiers, currentIdent, (void**)&val)) {
+        if(!tableGet(&state->identifiers, (void*)substitutedList[i], (void**)&val)) {
             Error* err = errNew(ERROR_SEMANTIC);
             errAddText(err, TextRed, "Found undefined resultant identifier "
                 "while substituting into bitgroup");
@@ -622,36 +736,59 @@ static void analyseBitgroup(Parser* parser, ASTStatement* s, AnalysisState* stat
     }
 
     value->as.bitgroup.substitutedIdentifiers = substitutedList;
-    value->as.bitgroup.lineLength = lineLength;
 }
 
 void Analyse(Parser* parser, VMCoreGen* core) {
     CONTEXT(INFO, "Running analysis");
+    MEMORY_TAG(MEMORY_ANALYSIS);
 
     if(parser->hadError)return;
 
     AnalysisState state;
     AnalysisStateInit(&state);
+    lineCacheInit(&state.lineCache);
 
+    StageTimer timer = stageBegin();
     for(unsigned int i = 0; i < core->commandCount; i++) {
-        char* key = (char*)core->commands[i].name;
+        char* key = (char*)intern(core->commands[i].name);
         Identifier* value = ArenaAlloc(sizeof(Identifier));
         value->type = TYPE_VM_CONTROL_BIT;
         value->as.control.value = i;
         tableSet(&state.identifiers, key, (void*)value);
     }
+    stageEnd(&timer, "identifiers", core->commandCount, "identifiers");
 
     for(unsigned int i = 0; i < parser->ast->statementCount; i++) {
         ASTStatement* s = &parser->ast->statements[i];
         if(!s->isValid) continue;
+        timer = stageBegin();
         switch(s->type) {
-            case AST_BLOCK_PARAMETER: analyseParameter(parser, s, &state); break;
-            case AST_BLOCK_HEADER: analyseHeader(parser, s, core, &state); break;
-            case AST_BLOCK_OPCODE: analyseOpcode(parser, s, core, &state); break;
-            case AST_BLOCK_TYPE: analyseType(parser, s, &state); break;
-            case AST_BLOCK_BITGROUP: analyseBitgroup(parser, s, &state); break;
+            case AST_BLOCK_PARAMETER:
+                analyseParameter(parser, s, &state);
+                stageEnd(&timer, "declarations", 1, "statements");
+                break;
+            case AST_BLOCK_HEADER:
+                analyseHeader(parser, s, core, &state);
+                stageEnd(&timer, "header", s->as.header.lineCount, "lines");
+                break;
+            case AST_BLOCK_OPCODE: {
+                unsigned int possibilities = analyseOpcode(parser, s, core,
+                    &state);
+                stageEndOpcode(&timer, s->as.opcode.name.data.string,
+                    possibilities);
+                break;
+            }
+            case AST_BLOCK_TYPE:
+                analyseType(parser, s, &state);
+                stageEnd(&timer, "declarations", 1, "statements");
+                break;
+            case AST_BLOCK_BITGROUP:
+                analyseBitgroup(parser, s, &state);
+                stageEnd(&timer, "declarations", 1, "statements");
+                break;
         }
     }
 
+    lineCacheFree(&state.lineCache);
     INFO("Finished Analysis");
 }
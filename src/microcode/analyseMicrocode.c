@@ -16,130 +16,315 @@ void printGraphState(void* g, graphPrintFn printFn) {
     }
 }
 
-// analyse an array of microcode bits
-// assumes that all the identifiers in the array exist and have the correct type
-NodeArray analyseLine(VMCoreGen* core, Parser* parser, ASTBitArray* line,
-    SourceRange* location, AnalysisState* state) {
-    CONTEXT(INFO, "Analysing line");
+// the set of commands in a line, one bit per command id, used as the key for
+// the line cache
+static unsigned int keyWordCount(VMCoreGen* core) {
+    return (core->commandCount + 63) / 64;
+}
 
-    Graph graph;
-    InitGraph(&graph, printGraphState);
+static uint32_t lineHash(void* value) {
+    LineAnalysis* line = value;
+    return (uint32_t)hashBytes(line->key, sizeof(uint64_t) * line->keyWords);
+}
 
-    for(unsigned int i = 0; i < line->dataCount; i++) {
-        // adds a command to the graph
-        // the command gets a node in the graph
-        // add edge command -> everything it changes
-        // add edge everything it depends on -> command
+static bool lineCmp(void* a, void* b) {
+    LineAnalysis* lineA = a;
+    LineAnalysis* lineB = b;
+    return lineA->keyWords == lineB->keyWords && memcmp(lineA->key, lineB->key,
+        sizeof(uint64_t) * lineA->keyWords) == 0;
+}
 
-        Identifier* bitIdent;
-        tableGet(&state->identifiers, (char*)line->datas[i].data.data.string,
-            (void**)&bitIdent);
-        unsigned int commandID = bitIdent->as.control.value;
-        Command* coreCommand = &core->commands[commandID];
-
-        Node* commandNode = AddNode(&graph, commandID,
-            coreCommand->name, (void*)GRAPH_STATE_COMMAND);
-
-        // adds edge between dependancies and commandNode
-        // id has commandCount added so the component id does not clash with
-        // the command id
-        for(unsigned int j = 0; j < coreCommand->dependsLength; j++) {
-            unsigned int dependCompID = coreCommand->depends[j];
-            Component* dependComp = &core->components[dependCompID];
-            Node* dependNode = AddNode(&graph, dependCompID+core->commandCount,
-                dependComp->printName, (void*)GRAPH_STATE_COMPONENT);
-            AddEdge(&graph, dependNode, commandNode);
+void lineCacheInit(LineCache* cache) {
+    initTable(&cache->lines, lineHash, lineCmp);
+    pthread_mutex_init(&cache->lock, NULL);
+}
+
+void lineCacheFree(LineCache* cache) {
+    pthread_mutex_destroy(&cache->lock);
+}
+
+// what is needed to build a line's graph when its error is printed, by which
+// time the core being analysed may be out of scope.  The arrays are arena
+// allocated so outlive it
+typedef struct LineGraphData {
+    Command* commands;
+    unsigned int commandCount;
+    Component* components;
+    LineAnalysis* line;
+} LineGraphData;
+
+// create the dependency graph of a set of commands, only used to describe
+// errors.  Commands are added in ascending id order so the graph only depends
+// on the set, not the order the commands were written in
+static void buildLineGraph(void* data, Graph* graph) {
+    LineGraphData* core = data;
+    LineAnalysis* line = core->line;
+    InitGraph(graph, printGraphState);
+
+    for(unsigned int word = 0; word < line->keyWords; word++) {
+        uint64_t bits = line->key[word];
+        while(bits != 0) {
+            unsigned int commandID = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            // adds a command to the graph
+            // the command gets a node in the graph
+            // add edge command -> everything it changes
+            // add edge everything it depends on -> command
+            Command* coreCommand = &core->commands[commandID];
+            Node* commandNode = AddNode(graph, commandID,
+                coreCommand->name, (void*)GRAPH_STATE_COMMAND);
+
+            // adds edge between dependancies and commandNode
+            // id has commandCount added so the component id does not clash
+            // with the command id
+            for(unsigned int j = 0; j < coreCommand->dependsLength; j++) {
+                unsigned int dependCompID = coreCommand->depends[j];
+                Component* dependComp = &core->components[dependCompID];
+                Node* dependNode = AddNode(graph,
+                    dependCompID+core->commandCount, dependComp->printName,
+                    (void*)GRAPH_STATE_COMPONENT);
+                AddEdge(graph, dependNode, commandNode);
+            }
+
+            // same as above loop but adds edge from commandNode to
+            // everything it changes
+            for(unsigned int j = 0; j < coreCommand->changesLength; j++) {
+                unsigned int changeCompID = coreCommand->changes[j];
+                Component* changeComp = &core->components[changeCompID];
+                Node* changeNode = AddNode(graph,
+                    changeCompID+core->commandCount, changeComp->printName,
+                    (void*)GRAPH_STATE_COMPONENT);
+                AddEdge(graph, commandNode, changeNode);
+            }
+        }
+    }
+}
+
+static bool masksIntersect(uint64_t* a, uint64_t* b, unsigned int words) {
+    for(unsigned int i = 0; i < words; i++) {
+        if(a[i] & b[i]) {
+            return true;
         }
+    }
+    return false;
+}
 
-        // same as above loop but adds edge from commandNode to everything
-        // it changes
-        for(unsigned int j = 0; j < coreCommand->changesLength; j++) {
-            unsigned int changeCompID = coreCommand->changes[j];
-            Component* changeComp = &core->components[changeCompID];
-            Node* changeNode = AddNode(&graph, changeCompID+core->commandCount,
-                changeComp->printName, (void*)GRAPH_STATE_COMPONENT);
-            AddEdge(&graph, commandNode, changeNode);
+static unsigned int maskCount(uint64_t* mask, unsigned int words) {
+    unsigned int count = 0;
+    for(unsigned int i = 0; i < words; i++) {
+        count += __builtin_popcountll(mask[i]);
+    }
+    return count;
+}
+
+// order the commands in a line and check its bus use, does not emit any
+// errors so the result can be shared between every line with the same set
+// of commands.  The result is allocated in long lived memory.
+static void orderLine(VMCoreGen* core, LineAnalysis* line) {
+    CONTEXT(INFO, "Ordering line");
+    ARENA_PERSISTENT();
+
+    ARRAY_ALLOC(unsigned int, *line, command);
+    ARRAY_ALLOC(LineErrorType, *line, error);
+
+    // the commands in the line, in ascending id order
+    unsigned int count = maskCount(line->key, line->keyWords);
+    unsigned int ids[count];
+    unsigned int idx = 0;
+    for(unsigned int word = 0; word < line->keyWords; word++) {
+        uint64_t bits = line->key[word];
+        while(bits != 0) {
+            ids[idx++] = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+    }
+
+    // a command has to run before every command that depends on a component
+    // it changes.  predecessors holds a bitmask over the line's commands for
+    // each command, a command that depends on its own change can never run
+    unsigned int words = (count + 63) / 64;
+    uint64_t predecessors[count * words + 1];
+    memset(predecessors, 0, sizeof(predecessors));
+    for(unsigned int i = 0; i < count; i++) {
+        uint64_t* changes = COMMAND_MASK(core, changes, ids[i]);
+        for(unsigned int j = 0; j < count; j++) {
+            if(masksIntersect(changes, COMMAND_MASK(core, depends, ids[j]),
+                core->componentWords)) {
+                predecessors[j * words + i / 64] |= (uint64_t)1 << (i % 64);
+            }
         }
     }
 
-    TRACE("Created command graph");
+    // repeatedly run the lowest id command with no predecessors left to run
+    uint64_t remaining[words + 1];
+    memset(remaining, 0, sizeof(remaining));
+    for(unsigned int i = 0; i < count; i++) {
+        remaining[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+
+    line->ordered = true;
+    for(unsigned int done = 0; done < count; done++) {
+        unsigned int next = count;
+        for(unsigned int i = 0; i < count && next == count; i++) {
+            if((remaining[i / 64] >> (i % 64) & 1) &&
+               !masksIntersect(&predecessors[i * words], remaining, words)) {
+                next = i;
+            }
+        }
+
+        // every command left is waiting on another, there is a cycle
+        if(next == count) {
+            line->ordered = false;
+            break;
+        }
+
+        remaining[next / 64] &= ~((uint64_t)1 << (next % 64));
+        ARRAY_PUSH(*line, command, ids[next]);
+    }
+
+    if(!line->ordered) {
+        line->commandCount = 0;
+        return;
+    }
 
-    // get execution order for the microcode bits
-    NodeArray nodes = TopologicalSort(&graph);
-    if(!nodes.validArray) {
+    // checking if any bus reads happen when the bus has not been written to
+    // and if any bus is written to more than once, in execution order
+    uint64_t written[core->componentWords + 1];
+    memset(written, 0, sizeof(written));
+
+    for(unsigned int i = 0; i < line->commandCount; i++) {
+        unsigned int command = line->commands[i];
+        uint64_t* reads = COMMAND_MASK(core, reads, command);
+        uint64_t* writes = COMMAND_MASK(core, writes, command);
+
+        unsigned int unwrittenReads = 0;
+        unsigned int repeatedWrites = 0;
+        for(unsigned int j = 0; j < core->componentWords; j++) {
+            unwrittenReads += __builtin_popcountll(reads[j] & ~written[j]);
+            repeatedWrites += __builtin_popcountll(writes[j] & written[j]);
+            written[j] |= writes[j];
+        }
+
+        for(unsigned int j = 0; j < unwrittenReads; j++) {
+            LineErrorType error = LINE_ERROR_READ_BEFORE_WRITE;
+            ARRAY_PUSH(*line, error, error);
+        }
+
+        for(unsigned int j = 0; j < repeatedWrites; j++) {
+            LineErrorType error = LINE_ERROR_WRITE_TWICE;
+            ARRAY_PUSH(*line, error, error);
+        }
+    }
+}
+
+// emit the errors found when a line was ordered, at the location of the line
+// currently being analysed
+static void reportLine(VMCoreGen* core, Parser* parser, ASTBitArray* bits,
+    SourceRange* location, LineAnalysis* line) {
+    if(line->ordered && line->errorCount == 0) {
+        return;
+    }
+
+    CONTEXT(INFO, "Reporting line errors");
+
+    // the graph is only built if the errors are printed
+    LineGraphData* graph;
+    {
+        ARENA_PERSISTENT();
+        MEMORY_TAG(MEMORY_ERROR);
+        graph = ArenaAlloc(sizeof(LineGraphData));
+    }
+    graph->commands = core->commands;
+    graph->commandCount = core->commandCount;
+    graph->components = core->components;
+    graph->line = line;
+
+    if(!line->ordered) {
         Error* err = errNew(ERROR_SEMANTIC);
         err->severity = ERROR_WARN;
         errAddText(err, TextYellow, "Unable to order microcode bits");
         errAddSource(err, location);
         errAddText(err, TextBlue, "Instruction graph (graphviz dot): ");
-        errAddGraph(err, &graph);
+        errAddGraph(err, buildLineGraph, graph);
         errAddText(err, TextBlue, "Substitutions: ");
-        for(unsigned int i = 0; i < line->dataCount; i++) {
-            if(line->datas[i].paramCount > 0) {
-                errAddText(err, TextWhite, line->datas[i].data.data.string);
+        for(unsigned int i = 0; i < bits->dataCount; i++) {
+            if(bits->datas[i].paramCount > 0) {
+                errAddText(err, TextWhite, bits->datas[i].data.data.string);
             }
         }
         errEmit(err, parser);
-        return nodes;
     }
 
-    // filter graph results for only commands, not components
-    NodeArray commands;
-    commands.validArray = true;
-    ARRAY_ALLOC(Node*, commands, node);
-    for(unsigned int i = 0; i < nodes.nodeCount; i++) {
-        Node* node = nodes.nodes[i];
-        if((GraphState)node->data == GRAPH_STATE_COMMAND) {
-            ARRAY_PUSH(commands, node, node);
+    for(unsigned int i = 0; i < line->errorCount; i++) {
+        Error* err = errNew(ERROR_SEMANTIC);
+        if(line->errors[i] == LINE_ERROR_READ_BEFORE_WRITE) {
+            errAddText(err, TextRed, "Command reads from bus before it was "
+                "written");
+        } else {
+            errAddText(err, TextRed, "Command writes to bus twice");
         }
+        errAddSource(err, location);
+        errAddText(err, TextBlue, "Command graph (graphviz dot):");
+        errAddGraph(err, buildLineGraph, graph);
+        errEmit(err, parser);
     }
+}
 
-    // checking if any bus reads happen when the bus has not been written to
+// analyse an array of microcode bits
+// assumes that all the identifiers in the array exist and have the correct type
+LineAnalysis* analyseLine(VMCoreGen* core, Parser* parser, ASTBitArray* line,
+    SourceRange* location, AnalysisState* state) {
+    CONTEXT(INFO, "Analysing line");
 
-    // set all busses to not set
-    for(unsigned int i = 0; i < core->componentCount; i++) {
-        Component* component = &core->components[i];
-        component->busStatus = false;
+    // find the set of commands used by the line
+    unsigned int keyWords = keyWordCount(core);
+    uint64_t key[keyWords];
+    memset(key, 0, sizeof(key));
+    for(unsigned int i = 0; i < line->dataCount; i++) {
+        Identifier* bitIdent;
+        tableGet(&state->identifiers, (char*)line->datas[i].data.data.string,
+            (void**)&bitIdent);
+        unsigned int commandID = bitIdent->as.control.value;
+        key[commandID / 64] |= (uint64_t)1 << (commandID % 64);
     }
 
-    // loop through all commands in execution order
-    for(unsigned int i = 0; i < commands.nodeCount; i++) {
-
-        Command* command = &core->commands[commands.nodes[i]->value];
-
-        // read from bus and check if possible
-        for(unsigned int j = 0; j < command->readsLength; j++) {
-            Component* bus = &core->components[command->reads[j]];
-            if(!bus->busStatus) {
-                Error* err = errNew(ERROR_SEMANTIC);
-                errAddText(err, TextRed, "Command reads from bus before it was "
-                    "written");
-                errAddSource(err, location);
-                errAddText(err, TextBlue, "Command graph (graphviz dot):");
-                errAddGraph(err, &graph);
-                errEmit(err, parser);
-                nodes.validArray = false;
-            }
-        }
-
-        // write to bus, allow it to be read from
-        // todo - do not allow multiple writes to a bus
-        for(unsigned int j = 0; j < command->writesLength; j++) {
-            Component* bus = &core->components[command->writes[j]];
-            if(bus->busStatus) {
-                Error* err = errNew(ERROR_SEMANTIC);
-                errAddText(err, TextRed, "Command writes to bus twice");
-                errAddSource(err, location);
-                errAddText(err, TextBlue, "Command graph (graphviz dot):");
-                errAddGraph(err, &graph);
-                errEmit(err, parser);
-            } else {
-                bus->busStatus = true;
-            }
+    LineAnalysis search = {
+        .key = key,
+        .keyWords = keyWords
+    };
+
+    // only order the commands if the set has not been seen before
+    LineCache* cache = &state->lineCache;
+    LineAnalysis* result;
+    pthread_mutex_lock(&cache->lock);
+    bool found = tableGet(&cache->lines, &search, (void**)&result);
+    pthread_mutex_unlock(&cache->lock);
+
+    if(!found) {
+        ARENA_PERSISTENT();
+        result = ArenaAlloc(sizeof(LineAnalysis));
+        result->keyWords = keyWords;
+        result->key = ArenaAlloc(sizeof(key));
+        memcpy(result->key, key, sizeof(key));
+        orderLine(core, result);
+
+        // another thread could have ordered the same set at the same time,
+        // either result is the same
+        pthread_mutex_lock(&cache->lock);
+        LineAnalysis* existing;
+        if(tableGet(&cache->lines, result, (void**)&existing)) {
+            result = existing;
+        } else {
+            tableSet(&cache->lines, result, result);
         }
+        pthread_mutex_unlock(&cache->lock);
+    } else {
+        TRACE("Line found in cache");
     }
 
-    return commands;
+    reportLine(core, parser, line, location, result);
+    return result;
 }
 
 // TODO- fix
@@ -200,7 +385,7 @@ bool mcodeBitArrayCheck(Parser* parser, ASTBitArray* arr, Table* paramNames, Ana
     return passed;
 }
 
-NodeArray substituteAnalyseLine(ASTBitArray* bits, VMCoreGen* core,
+LineAnalysis* substituteAnalyseLine(ASTBitArray* bits, VMCoreGen* core,
     Parser* parser, ASTStatementOpcode* opcode, unsigned int possibility,
     unsigned int lineNumber, AnalysisState* state)
 {
@@ -239,9 +424,11 @@ NodeArray substituteAnalyseLine(ASTBitArray* bits, VMCoreGen* core,
                 possibility -= currentNumber;
                 possibility /= paramType->as.userType.as.enumType.memberCount;
 
-                if(strcmp(bit->params[0].name.data.string, opcode->params[j].value.data.string) == 0) {
-                    ASTBit newBit;
-                    newBit.data = createStrToken((char*)&val->as.bitgroup.substitutedIdentifiers[currentNumber*val->as.bitgroup.lineLength]);
+                if(bit->params[0].name.data.string == opcode->params[j].value.data.string) {
+                    // keep the parameters so the substitution can be
+                    // reported in errors
+                    ASTBit newBit = *bit;
+                    newBit.data = createStrToken(val->as.bitgroup.substitutedIdentifiers[currentNumber]);
                     ARRAY_PUSH(subsLine, data, newBit);
                 }
             }
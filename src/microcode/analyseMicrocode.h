@@ -7,12 +7,39 @@
 #include "microcode/analysisTypes.h"
 #include "emulator/compiletime/create.h"
 
-NodeArray analyseLine(VMCoreGen* core, Parser* parser, ASTBitArray* line,
+typedef enum LineErrorType {
+    LINE_ERROR_READ_BEFORE_WRITE,
+    LINE_ERROR_WRITE_TWICE
+} LineErrorType;
+
+// result of ordering a set of commands, shared by every line using the set
+typedef struct LineAnalysis {
+    // bitmask of the command ids in the set
+    uint64_t* key;
+    unsigned int keyWords;
+
+    // could the commands be ordered, bus errors do not stop the line being
+    // used so the rest of the opcode is still analysed
+    bool ordered;
+
+    // command ids in execution order
+    ARRAY_DEFINE(unsigned int, command);
+
+    // bus errors, in the order they were found
+    ARRAY_DEFINE(LineErrorType, error);
+} LineAnalysis;
+
+void lineCacheInit(LineCache* cache);
+void lineCacheFree(LineCache* cache);
+
+// order the commands in a line and check the line uses the busses correctly,
+// emitting any errors found at location
+LineAnalysis* analyseLine(VMCoreGen* core, Parser* parser, ASTBitArray* line,
     SourceRange* location, AnalysisState* state);
 
 bool mcodeBitArrayCheck(Parser* parser, ASTBitArray* arr, Table* paramNames, AnalysisState* state);
 
-NodeArray substituteAnalyseLine(ASTBitArray* bits, VMCoreGen* core,
+LineAnalysis* substituteAnalyseLine(ASTBitArray* bits, VMCoreGen* core,
     Parser* parser, ASTStatementOpcode* opcode, unsigned int possibility,
     unsigned int lineNumber, AnalysisState* state);
 
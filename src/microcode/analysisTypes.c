@@ -1,4 +1,5 @@
 #include "analysisTypes.h"
+#include "shared/intern.h"
 
 char* UserTypeNames[] = {
     [AST_TYPE_STATEMENT_ANY] = "any",
@@ -15,6 +16,7 @@ char *IdentifierTypeNames[] = {
 void AnalysisStateInit(AnalysisState* state) {
     state->erroredParametersInitialized = false;
     state->parsedHeader = false;
+    state->notParsedHeaderThrown = false;
     state->firstHeader = NULL;
-    initTable(&state->identifiers, strHash, strCmp);
+    initTable(&state->identifiers, atomHash, atomCmp);
 }
\ No newline at end of file
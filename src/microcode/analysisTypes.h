@@ -1,6 +1,7 @@
 #ifndef ANALYSIS_TYPES_H
 #define ANALYSIS_TYPES_H
 
+#include <pthread.h>
 #include "shared/memory.h"
 #include "shared/table.h"
 #include "microcode/ast.h"
@@ -51,11 +52,8 @@ typedef struct IdentifierUserType {
 typedef struct IdentifierBitGroup {
     Token* definition;
 
-    // maximum length of all identifiers in group + null byte
-    unsigned int lineLength;
-
-    // list of null terminated strings of length lineLength
-    char* substitutedIdentifiers;
+    // atom of the control bit formed by each possible substitution
+    const char** substitutedIdentifiers;
 } IdentifierBitGroup;
 
 // all possible types
@@ -80,6 +78,13 @@ typedef struct Identifier {
     } as;
 } Identifier;
 
+// results of analysing each distinct set of control bits, as the same sets
+// appear in many lines.  Shared by every thread analysing the file
+typedef struct LineCache {
+    Table lines;
+    pthread_mutex_t lock;
+} LineCache;
+
 typedef struct AnalysisState {
     // table mapping names to types
     Table identifiers;
@@ -90,8 +95,14 @@ typedef struct AnalysisState {
     // has a header statement been analysed yet?
     bool parsedHeader;
 
+    // has the error for an opcode before the header been emitted, only
+    // reported once per file
+    bool notParsedHeaderThrown;
+
 // the header statement AST, used for emitting duplicate header errors
     ASTStatement* firstHeader;
+
+    LineCache lineCache;
 } AnalysisState;
 
 void AnalysisStateInit(AnalysisState* state);
@@ -0,0 +1,84 @@
+#include "microcode/bench.h"
+
+#include "shared/platform.h"
+#include "shared/memory.h"
+#include "shared/buffer.h"
+#include "shared/log.h"
+#include "microcode/scanner.h"
+
+// build a microcode file resembling a large generated instruction set, the
+// content does not have to be valid, only representative for the scanner
+static FileBuffer generateSource(size_t size) {
+    Buffer source;
+    bufferInit(&source);
+
+    bufferPuts(&source, "# generated scanner benchmark input\n"
+        "opsize: 16\nphase: 4\n\ninclude \"types\"\n\n"
+        "header {\n    IPToAddress, memReadToInst, iRegSet\n}\n\n");
+
+    for(unsigned int i = 0; source.charCount < size; i++) {
+        bufferPrintf(&source, "# opcode %u, moves between two registers "
+            "through the data bus\n", i);
+        bufferPuts(&source, "opcode op");
+        bufferPrintf(&source, "%u 0b", i);
+        for(int bit = 9; bit >= 0; bit--) {
+            bufferPutc(&source, (i >> bit) & 1 ? '1' : '0');
+        }
+        bufferPuts(&source, "(Reg rega, Reg regb) {\n"
+            "    IPToAddress, memReadToInst, iRegSet;\n"
+            "    RegToAddress(rega), memReadToData, DataToReg(regb);\n"
+            "    AToAddress, memReadToData, DataToB;   # trailing comment\n"
+            "}\n\n");
+    }
+
+    return (FileBuffer){source.chars, source.charCount};
+}
+
+bool runScannerBench(const char* fileName, unsigned int megabytes,
+    unsigned int repeat) {
+    CONTEXT(INFO, "Running scanner benchmark");
+
+    FileBuffer source;
+    if(fileName != NULL) {
+        if(!mapFile(fileName, &source)) {
+            cErrPrintf(TextRed, "Could not read file \"%s\"\n", fileName);
+            return false;
+        }
+    } else {
+        fileName = "generated.uasm";
+        source = generateSource((size_t)megabytes * 1000000);
+    }
+    size_t length = source.length;
+
+    double best = 0;
+    unsigned int tokens = 0;
+    for(unsigned int i = 0; i < repeat; i++) {
+        // tokens are not kept, so release them after every run
+        ArenaTemp temp = ArenaTempBegin();
+
+        Scanner scanner;
+        double start = monotonicTime();
+        ScannerInit(&scanner, source.data, source.length, fileName);
+        tokens = 0;
+        for(;;) {
+            Token token = ScanToken(&scanner);
+            tokens++;
+            if(token.type == TOKEN_EOF) {
+                break;
+            }
+        }
+        double time = monotonicTime() - start;
+
+        ArenaTempEnd(temp);
+
+        INFO("Run %u took %fs", i, time);
+        if(i == 0 || time < best) {
+            best = time;
+        }
+    }
+
+    cOutPrintf(TextWhite, "Scanned %zu bytes, %u tokens\n", length, tokens);
+    cOutPrintf(TextWhite, "Fastest of %u runs: %.3fms, %.1f MB/s\n", repeat,
+        best * 1000, best > 0 ? length / best / 1e6 : 0);
+    return true;
+}
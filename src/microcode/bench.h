@@ -0,0 +1,12 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+
+// time how long scanning takes and report the throughput.  Scans fileName,
+// or when it is NULL, a generated file of about megabytes MB.  The scan is
+// repeated and the fastest run reported.
+bool runScannerBench(const char* fileName, unsigned int megabytes,
+    unsigned int repeat);
+
+#endif
@@ -2,28 +2,33 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
 #include "shared/memory.h"
 #include "shared/platform.h"
+#include "shared/buffer.h"
 #include "microcode/parser.h"
 #include "microcode/error.h"
 #include "shared/log.h"
 
 
-static void printLine(SourceRange* range, int lineNumberLength, int offset,
-    int* start, int* length)
+static void printLine(ColorBuffer* buf, SourceRange* range,
+    int lineNumberLength, int offset, int* start, int* length)
 {
     if(getLine(range->sourceStart, range->line + offset, start, length)) {
-        cErrPrintf(TextWhite, "  %*i | %.*s\n", lineNumberLength,
+        colorBufferPrintf(buf, TextWhite, "  %*i | %.*s\n", lineNumberLength,
             range->line + offset, *length, range->sourceStart + *start);
     }
 }
 
-// print a message about a token to stderr
-static void printMessage(SourceRange* range, TextColor color) {
+// print a message about a token
+static void printMessage(ColorBuffer* buf, SourceRange* range,
+    TextColor color) {
     CONTEXT(DEBUG, "Printing Error Source");
 
     // file name/location
-    cErrPrintf(TextWhite, "  --> %s:%i:%i\n", range->filename, range->line, range->column);
+    colorBufferPrintf(buf, TextWhite, "  --> %s:%i:%i\n", range->filename,
+        range->line, range->column);
 
     // number of charcters required to print the longest line number
     int lineNumberLength = floor(log10(abs(range->line + 1))) + 1;
@@ -32,39 +37,43 @@ static void printMessage(SourceRange* range, TextColor color) {
     int length;
 
     // line before the error
-    printLine(range, lineNumberLength, -1, &start, &length);
+    printLine(buf, range, lineNumberLength, -1, &start, &length);
 
     // line with the error token on
-    printLine(range, lineNumberLength, 0, &start, &length);
+    printLine(buf, range, lineNumberLength, 0, &start, &length);
 
     // how far along the line the error token starts
     int startPos = range->tokenStart - range->sourceStart - start;
 
 
-    cErrPrintf(TextWhite, "  %*s | ", lineNumberLength, "");
+    colorBufferPrintf(buf, TextWhite, "  %*s | ", lineNumberLength, "");
     for(int i = 0; i < length; i++) {
         if(i >= startPos && i < startPos + range->length) {
-            cErrPutchar(color, '^');
+            colorBufferPutc(buf, color, '^');
         } else {
-            cErrPutchar(color, ' ');
+            colorBufferPutc(buf, color, ' ');
         }
     }
 
-    cErrPutchar(TextRed, '\n');
+    colorBufferPutc(buf, TextRed, '\n');
 
     // line after error token
-    printLine(range, lineNumberLength, 1, &start, &length);
+    printLine(buf, range, lineNumberLength, 1, &start, &length);
 
-    cErrPutchar(TextRed, '\n');
+    colorBufferPutc(buf, TextRed, '\n');
 }
 
 Error* errNew(ErrorLevel level) {
     CONTEXT(INFO, "Creating Error");
+    ARENA_PERSISTENT();
+    MEMORY_TAG(MEMORY_ERROR);
     Error* err = ArenaAlloc(sizeof(Error));
 
     err->level = level;
     err->severity = ERROR_ERROR;
+    err->instanceTotal = 1;
     ARRAY_ALLOC(ErrorChunk, *err, chunk);
+    ARRAY_ALLOC(const char*, *err, instance);
 
     return err;
 }
@@ -78,31 +87,58 @@ void errAddText(Error* err, TextColor color, const char* text, ...) {
 
 void vErrAddText(Error* err, TextColor color, const char* text, va_list args) {
     CONTEXT(TRACE, "Adding text to error");
+    ARENA_PERSISTENT();
+    MEMORY_TAG(MEMORY_ERROR);
     ErrorChunk chunk;
     chunk.type = ERROR_CHUNK_TEXT;
     chunk.as.text.message = vaprintf(text, args);
     chunk.as.text.color = color;
+    chunk.as.text.format = text;
     ARRAY_PUSH(*err, chunk, chunk);
 }
 
 void errAddSource(Error* err, SourceRange* loc) {
     CONTEXT(TRACE, "Adding source to error");
+    ARENA_PERSISTENT();
+    MEMORY_TAG(MEMORY_ERROR);
     ErrorChunk chunk;
     chunk.type = ERROR_CHUNK_SOURCE;
     chunk.as.source = *loc;
     ARRAY_PUSH(*err, chunk, chunk);
 }
 
-void errAddGraph(Error* err, Graph* graph) {
+void errAddGraph(Error* err, ErrorGraphFn build, void* data) {
     CONTEXT(TRACE, "Adding graph to error");
+    ARENA_PERSISTENT();
+    MEMORY_TAG(MEMORY_ERROR);
     ErrorChunk chunk;
     chunk.type = ERROR_CHUNK_GRAPH;
-    chunk.as.graph = *graph;
+    chunk.as.graph.build = build;
+    chunk.as.graph.data = data;
     ARRAY_PUSH(*err, chunk, chunk);
 }
 
+void errBuildGraph(ErrorChunk* chunk, Graph* graph) {
+    CONTEXT(DEBUG, "Building error graph");
+    MEMORY_TAG(MEMORY_GRAPH);
+    chunk->as.graph.build(chunk->as.graph.data, graph);
+}
+
+// only a few instances are described, the rest are counted
+#define ERROR_INSTANCE_MAX 3
+
+void errAddInstance(Error* err, const char* instance) {
+    ARENA_PERSISTENT();
+    MEMORY_TAG(MEMORY_ERROR);
+    if(instance != NULL && err->instanceCount < ERROR_INSTANCE_MAX) {
+        ARRAY_PUSH(*err, instance, instance);
+    }
+}
+
 void errEmit(Error* err, struct Parser* parser) {
     CONTEXT(INFO, "Emitting created error");
+    ARENA_PERSISTENT();
+    MEMORY_TAG(MEMORY_ERROR);
     if(err->severity == ERROR_ERROR) {
         if(parser->panicMode) return;
         parser->hadError = true;
@@ -116,41 +152,168 @@ void errEmit(Error* err, struct Parser* parser) {
     ARRAY_PUSH(*parser, error, err);
 }
 
+// the first message and location of an error, which are the same for every
+// instance of the same problem
+static void errorKey(Error* err, ErrorChunk** text, ErrorChunk** source) {
+    *text = NULL;
+    *source = NULL;
+    for(unsigned int i = 0; i < err->chunkCount; i++) {
+        ErrorChunk* chunk = &err->chunks[i];
+        if(chunk->type == ERROR_CHUNK_TEXT && *text == NULL) {
+            *text = chunk;
+        } else if(chunk->type == ERROR_CHUNK_SOURCE && *source == NULL) {
+            *source = chunk;
+        }
+    }
+}
+
+static uint32_t errorHash(void* value) {
+    ErrorChunk* text;
+    ErrorChunk* source;
+    errorKey(value, &text, &source);
+
+    uint64_t hash = ((Error*)value)->severity;
+    if(text != NULL) {
+        hash ^= strHash((char*)text->as.text.format);
+    }
+    if(source != NULL) {
+        hash = hash * 31 + (uintptr_t)source->as.source.tokenStart;
+        hash = hash * 31 + source->as.source.length;
+    }
+    return hash ^ (hash >> 32);
+}
+
+static bool errorCmp(void* a, void* b) {
+    Error* errA = a;
+    Error* errB = b;
+    ErrorChunk* textA;
+    ErrorChunk* sourceA;
+    ErrorChunk* textB;
+    ErrorChunk* sourceB;
+    errorKey(errA, &textA, &sourceA);
+    errorKey(errB, &textB, &sourceB);
+
+    if(errA->level != errB->level || errA->severity != errB->severity ||
+       (textA == NULL) != (textB == NULL) ||
+       (sourceA == NULL) != (sourceB == NULL)) {
+        return false;
+    }
+    if(textA != NULL &&
+       strcmp(textA->as.text.format, textB->as.text.format) != 0) {
+        return false;
+    }
+    if(sourceA != NULL &&
+       (sourceA->as.source.tokenStart != sourceB->as.source.tokenStart ||
+        sourceA->as.source.length != sourceB->as.source.length)) {
+        return false;
+    }
+    return true;
+}
+
+void errSetInit(ErrorSet* set, Parser* parser) {
+    set->parser = parser;
+    initTable(&set->errors, errorHash, errorCmp);
+}
+
+void errSetAdd(ErrorSet* set, Error* err, unsigned int instance,
+    const char* description) {
+    CONTEXT(TRACE, "Adding error to set");
+    Error* existing;
+    if(tableGet(&set->errors, err, (void**)&existing)) {
+        if(existing->lastInstance != instance) {
+            existing->lastInstance = instance;
+            existing->instanceTotal += err->instanceTotal;
+            errAddInstance(existing, description);
+        }
+        return;
+    }
+
+    err->lastInstance = instance;
+    errAddInstance(err, description);
+    tableSet(&set->errors, err, err);
+    ARRAY_PUSH(*set->parser, error, err);
+}
+
+// graphs can only be printed through a function, this is the error they are
+// being printed into
+static _Thread_local ColorBuffer* graphOutput;
+
+static void printGraphOutput(TextColor color, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    colorBufferVPrintf(graphOutput, color, format, args);
+    va_end(args);
+}
+
+// build the whole error in memory, so it is written with a single call and the
+// color is only changed when it needs to be
+static void printError(Error* err) {
+    CONTEXT(DEBUG, "Printing error");
+    ArenaTemp temp = ArenaTempBegin();
+
+    ColorBuffer buf;
+    colorBufferInit(&buf);
+
+    if(err->level == ERROR_SYNTAX) {
+        colorBufferPrintf(&buf, TextWhite, "Syntax ");
+    } else if(err->level == ERROR_SEMANTIC) {
+        colorBufferPrintf(&buf, TextWhite, "Semantic ");
+    }
+    if(err->severity == ERROR_ERROR) {
+        colorBufferPrintf(&buf, TextWhite, "Error:\n");
+    } else if(err->severity == ERROR_WARN) {
+        colorBufferPrintf(&buf, TextWhite, "Warning:\n");
+    }
+
+    TextColor color = TextWhite;
+    for(unsigned int i = 0; i < err->chunkCount; i++) {
+        ErrorChunk* chunk = &err->chunks[i];
+        switch(chunk->type) {
+            case ERROR_CHUNK_TEXT:
+                colorBufferPrintf(&buf, chunk->as.text.color,
+                    chunk->as.text.message);
+                colorBufferPutc(&buf, TextWhite, '\n');
+                color = chunk->as.text.color;
+                break;
+            case ERROR_CHUNK_SOURCE:
+                printMessage(&buf, &chunk->as.source, color);
+                break;
+            case ERROR_CHUNK_GRAPH: {
+                Graph graph;
+                errBuildGraph(chunk, &graph);
+                graphOutput = &buf;
+                printGraph(&graph, printGraphOutput);
+                break;
+            }
+        }
+    }
+
+    // the chunks describe the first instance
+    if(err->instanceTotal > 1) {
+        colorBufferPrintf(&buf, TextBlue, "Found %u times, including:\n",
+            err->instanceTotal);
+        for(unsigned int i = 0; i < err->instanceCount; i++) {
+            colorBufferPrintf(&buf, TextWhite, "  %s\n", err->instances[i]);
+        }
+    }
+    colorBufferPutc(&buf, TextWhite, '\n');
+
+    cErrWriteBuffer(&buf);
+    ArenaTempEnd(temp);
+}
+
 void printErrors(Parser* parser) {
+    MEMORY_TAG(MEMORY_ERROR);
     int errors = 0;
     int warnings = 0;
     for(unsigned int i = 0; i < parser->errorCount; i++) {
         Error* err = parser->errors[i];
-        if(err->level == ERROR_SYNTAX) {
-            cErrPrintf(TextWhite, "Syntax ");
-        } else if(err->level == ERROR_SEMANTIC) {
-            cErrPrintf(TextWhite, "Semantic ");
-        }
+        printError(err);
         if(err->severity == ERROR_ERROR) {
-            cErrPrintf(TextWhite, "Error:\n");
             errors++;
         } else if(err->severity == ERROR_WARN) {
-            cErrPrintf(TextWhite, "Warning:\n");
             warnings++;
         }
-
-        TextColor color = TextWhite;
-        for(unsigned int j = 0; j < err->chunkCount; j++) {
-            ErrorChunk* chunk = &err->chunks[j];
-            switch(chunk->type) {
-                case ERROR_CHUNK_TEXT:
-                    cErrPrintf(chunk->as.text.color, chunk->as.text.message);
-                    cErrPrintf(TextWhite, "\n");
-                    color = chunk->as.text.color;
-                    break;
-                case ERROR_CHUNK_SOURCE:
-                    printMessage(&chunk->as.source, color);
-                    break;
-                case ERROR_CHUNK_GRAPH:
-                    printGraph(&chunk->as.graph, cErrPrintf);
-            }
-        }
-        cErrPrintf(TextWhite, "\n");
     }
 
     if(warnings > 0) {
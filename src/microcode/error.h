@@ -4,6 +4,7 @@
 #include <stdarg.h>
 #include "shared/platform.h"
 #include "shared/graph.h"
+#include "shared/table.h"
 #include "microcode/token.h"
 
 typedef enum ErrorLevel {
@@ -11,6 +12,10 @@ typedef enum ErrorLevel {
     ERROR_SEMANTIC,
 } ErrorLevel;
 
+// builds the graph shown in an error from the data given to errAddGraph, so
+// the graph is only created if the error is printed
+typedef void (*ErrorGraphFn)(void* data, Graph* graph);
+
 typedef struct ErrorChunk {
     enum {
         ERROR_CHUNK_TEXT,
@@ -22,9 +27,16 @@ typedef struct ErrorChunk {
         struct {
             const char* message;
             TextColor color;
+
+            // what the message was created from, errors with the same format
+            // describe the same problem
+            const char* format;
         } text;
         SourceRange source;
-        Graph graph;
+        struct {
+            ErrorGraphFn build;
+            void* data;
+        } graph;
     } as;
 } ErrorChunk;
 
@@ -36,15 +48,45 @@ typedef struct Error {
         ERROR_ERROR,
         ERROR_WARN
     } severity;
+
+    // number of times the error was found, such as in every possibility of an
+    // opcode, and descriptions of where the first few of those were
+    unsigned int instanceTotal;
+    ARRAY_DEFINE(const char*, instance);
+
+    // the instance the error was last found in by an ErrorSet, so an error
+    // repeated within one instance is only counted once
+    unsigned int lastInstance;
 } Error;
 
+// errors found in many instances of the same code, like the possibilities of
+// an opcode, are combined if they have the same first location and message
+typedef struct ErrorSet {
+    struct Parser* parser;
+    Table errors;
+} ErrorSet;
+
 Error* errNew(ErrorLevel level);
 void errAddText(Error* err, TextColor color, const char* text, ...);
 void vErrAddText(Error* err, TextColor color, const char* text, va_list args);
 void errAddSource(Error* err, SourceRange* loc);
-void errAddGraph(Error* err, Graph* graph);
+void errAddGraph(Error* err, ErrorGraphFn build, void* data);
 void errEmit(Error* err, struct Parser* parser);
 
+// create the graph of a graph chunk in the current arena
+void errBuildGraph(ErrorChunk* chunk, Graph* graph);
+
+// record another place an error was found
+void errAddInstance(Error* err, const char* instance);
+
+void errSetInit(ErrorSet* set, struct Parser* parser);
+
+// add an error to the set's parser, or count it as another instance of an
+// equivalent error already added.  instance identifies where it was found,
+// and description describes it
+void errSetAdd(ErrorSet* set, Error* err, unsigned int instance,
+    const char* description);
+
 void printErrors(struct Parser* parser);
 
 #endif
@@ -0,0 +1,213 @@
+#include "microcode/includeCache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "shared/platform.h"
+#include "shared/buffer.h"
+#include "shared/table.h"
+#include "shared/path.h"
+#include "shared/thread.h"
+#include "shared/log.h"
+#include "microcode/parser.h"
+#include "microcode/error.h"
+
+// a file read while parsing an include, and its version at the time
+typedef struct IncludeDependency {
+    const char* fileName;
+    FileVersion version;
+} IncludeDependency;
+
+typedef struct CacheEntry {
+    IncludeResult result;
+    ARRAY_DEFINE(IncludeDependency, dependency);
+} CacheEntry;
+
+// parsed includes by cacheKey
+static Table cache;
+static bool cacheInitialized = false;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+// the included file followed by the folders searched for the files it
+// includes, as a different search path could find different files
+static const char* cacheKey(const char* fileName, AST* ast) {
+    Buffer key;
+    bufferInit(&key);
+    bufferPuts(&key, fileName);
+
+    for(unsigned int i = 0; i < ast->fileNameCount; i++) {
+        const char* folder = ast->fileNames[i];
+        size_t length = pathGetFolderLength(folder);
+
+        bool duplicate = false;
+        for(unsigned int j = 0; j < i && !duplicate; j++) {
+            duplicate = pathGetFolderLength(ast->fileNames[j]) == length &&
+                memcmp(ast->fileNames[j], folder, length) == 0;
+        }
+
+        if(!duplicate) {
+            bufferPutc(&key, '\n');
+            bufferWrite(&key, folder, length);
+        }
+    }
+
+    return key.chars;
+}
+
+// have none of the files read to create the entry changed since?
+static bool entryCurrent(CacheEntry* entry) {
+    for(unsigned int i = 0; i < entry->dependencyCount; i++) {
+        IncludeDependency* dependency = &entry->dependencys[i];
+        FileVersion version;
+        if(!getFileVersion(dependency->fileName, &version) ||
+           version.modified != dependency->version.modified ||
+           version.size != dependency->version.size) {
+            INFO("%s has changed", dependency->fileName);
+            return false;
+        }
+    }
+    return true;
+}
+
+static CacheEntry* parseInclude(const char* fileName, AST* ast) {
+    CONTEXT(INFO, "Parsing included file");
+
+    FileBuffer source;
+    if(!mapFile(fileName, &source)) {
+        return NULL;
+    }
+
+    // parse into a separate ast starting with the files included so far, so
+    // nested includes are searched for as if the file was parsed in place
+    AST included;
+    InitAST(&included);
+    for(unsigned int i = 0; i < ast->fileNameCount; i++) {
+        ARRAY_PUSH(included, fileName, ast->fileNames[i]);
+    }
+
+    Scanner scanner;
+    Parser parser;
+    ScannerInit(&scanner, source.data, source.length, fileName);
+    Parse(&parser, &scanner, &included);
+
+    CacheEntry* entry = ArenaAlloc(sizeof(CacheEntry));
+    IncludeResult* result = &entry->result;
+    result->statements = included.statements;
+    result->statementCount = included.statementCount;
+    result->statementCapacity = included.statementCapacity;
+    result->statementElementSize = included.statementElementSize;
+    result->errors = parser.errors;
+    result->errorCount = parser.errorCount;
+    result->errorCapacity = parser.errorCapacity;
+    result->errorElementSize = parser.errorElementSize;
+    result->hadError = parser.hadError;
+
+    ARRAY_ALLOC(const char*, *result, fileName);
+    ARRAY_ALLOC(IncludeDependency, *entry, dependency);
+    for(unsigned int i = ast->fileNameCount; i < included.fileNameCount; i++) {
+        IncludeDependency dependency;
+        dependency.fileName = included.fileNames[i];
+        if(!getFileVersion(dependency.fileName, &dependency.version)) {
+            dependency.version = (FileVersion){0};
+        }
+        ARRAY_PUSH(*result, fileName, included.fileNames[i]);
+        ARRAY_PUSH(*entry, dependency, dependency);
+    }
+
+    return entry;
+}
+
+IncludeResult* includeFile(const char* fileName, AST* ast) {
+    CONTEXT(INFO, "Including %s", fileName);
+    ARENA_PERSISTENT();
+    MEMORY_TAG(MEMORY_AST);
+
+    const char* key = cacheKey(resolvePath(fileName), ast);
+
+    pthread_mutex_lock(&cacheLock);
+    if(!cacheInitialized) {
+        initTable(&cache, strHash, strCmp);
+        cacheInitialized = true;
+    }
+    CacheEntry* entry;
+    bool found = tableGet(&cache, (void*)key, (void**)&entry);
+    pthread_mutex_unlock(&cacheLock);
+
+    if(found && entryCurrent(entry)) {
+        INFO("Reusing earlier parse");
+        return &entry->result;
+    }
+
+    // parsed without the lock held, if two threads parse the same file at
+    // once either result can be kept
+    entry = parseInclude(fileName, ast);
+    if(entry == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cacheLock);
+    tableSet(&cache, (void*)key, entry);
+    pthread_mutex_unlock(&cacheLock);
+
+    return &entry->result;
+}
+
+typedef struct Prefetch {
+    ARRAY_DEFINE(const char*, fileName);
+    AST* ast;
+} Prefetch;
+
+static void prefetchInclude(void* data, unsigned int index) {
+    Prefetch* prefetch = data;
+    includeFile(prefetch->fileNames[index], prefetch->ast);
+}
+
+void includePrefetch(const Scanner* scanner, AST* ast) {
+    CONTEXT(INFO, "Prefetching included files");
+
+    // only worth scanning the source twice if the includes can be spread
+    // across threads
+    if(threadCount() < 2) {
+        return;
+    }
+
+    ArenaTemp temp = ArenaTempBegin();
+
+    Prefetch prefetch;
+    prefetch.ast = ast;
+    ARRAY_ALLOC(const char*, prefetch, fileName);
+
+    // rescan from the start, files that cannot be found are left for the
+    // parser to report
+    Scanner copy = *scanner;
+    copy.current = copy.base;
+    copy.start = copy.base;
+    copy.line = 1;
+    copy.column = 1;
+    for(Token token = ScanToken(&copy); token.type != TOKEN_EOF;
+        token = ScanToken(&copy)) {
+        if(token.type != TOKEN_INCLUDE) {
+            continue;
+        }
+
+        token = ScanToken(&copy);
+        if(token.type != TOKEN_STRING) {
+            continue;
+        }
+
+        char* foundFileName;
+        FILE* file = pathStackSearchFileList(token.data.string, "uasm",
+            ast->fileNameCount, ast->fileNames, &foundFileName);
+        if(file != NULL) {
+            fclose(file);
+            ARRAY_PUSH(prefetch, fileName, (const char*)foundFileName);
+        }
+    }
+
+    INFO("Found %u included files", prefetch.fileNameCount);
+    if(prefetch.fileNameCount >= 2) {
+        parallelFor(prefetch.fileNameCount, prefetchInclude, &prefetch);
+    }
+
+    ArenaTempEnd(temp);
+}
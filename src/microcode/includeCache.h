@@ -0,0 +1,30 @@
+#ifndef INCLUDE_CACHE_H
+#define INCLUDE_CACHE_H
+
+#include <stdbool.h>
+#include "shared/memory.h"
+#include "microcode/scanner.h"
+#include "microcode/ast.h"
+
+struct Error;
+
+// everything parsing an included file added to the ast, including the files
+// it included itself.  Shared between every ast including the file, so must
+// not be modified
+typedef struct IncludeResult {
+    ARRAY_DEFINE(ASTStatement, statement);
+    ARRAY_DEFINE(const char*, fileName);
+    ARRAY_DEFINE(struct Error*, error);
+    bool hadError;
+} IncludeResult;
+
+// parse a file included from ast, or reuse an earlier parse of it with the
+// same include search path, if none of the files it read have changed since.
+// returns NULL if the file could not be read
+IncludeResult* includeFile(const char* fileName, AST* ast);
+
+// parse the files a source includes in parallel, ahead of the parser reaching
+// them, so the parser can take them from the cache
+void includePrefetch(const Scanner* scanner, AST* ast);
+
+#endif
@@ -9,6 +9,7 @@
 #include "microcode/parser.h"
 #include "microcode/ast.h"
 #include "microcode/error.h"
+#include "microcode/includeCache.h"
 
 static void newErrorState(Parser* parser) {
     CONTEXT(DEBUG, "New error state");
@@ -398,16 +399,31 @@ static void include(Parser* parser) {
             return;
         }
 
+        fclose(file);
+
         INFO("Found file to include, parsing");
-        Scanner* newScanner = ArenaAlloc(sizeof(Scanner));
-        Parser* newParser = ArenaAlloc(sizeof(Parser));
-        ScannerInit(newScanner, readFilePtr(file), foundFileName);
-        Parse(newParser, newScanner, parser->ast);
+        IncludeResult* included = includeFile(foundFileName, parser->ast);
+        if(included == NULL) {
+            Error* err = errNew(ERROR_SEMANTIC);
+            errAddText(err, TextRed, "Could not read file \"%s\"",
+                foundFileName);
+            errAddSource(err, &parser->previous.range);
+            errEmit(err, parser);
+            return;
+        }
 
-        if(newParser->hadError){
+        // add everything parsing the file added to the ast, as if it was parsed in place
+        for(unsigned int i = 0; i < included->statementCount; i++) {
+            ARRAY_PUSH(*parser->ast, statement, included->statements[i]);
+        }
+        for(unsigned int i = 0; i < included->fileNameCount; i++) {
+            ARRAY_PUSH(*parser->ast, fileName, included->fileNames[i]);
+        }
+
+        if(included->hadError){
             parser->hadError = true;
-            for(unsigned int i = 0; i < newParser->errorCount; i++) {
-                ARRAY_PUSH(*parser, error, newParser->errors[i]);
+            for(unsigned int i = 0; i < included->errorCount; i++) {
+                ARRAY_PUSH(*parser, error, included->errors[i]);
             }
         }
 
@@ -529,6 +545,8 @@ static bool runParser(Parser* parser) {
     ARRAY_PUSH(*parser->ast, fileName, parser->scanner->fileName);
     DEBUG("Filename checks passed");
 
+    includePrefetch(parser->scanner, parser->ast);
+
     INFO("Starting parsing");
     while(!match(parser, TOKEN_EOF)){
         // all file-level constructs are blocks of some form
@@ -541,6 +559,7 @@ static bool runParser(Parser* parser) {
 
 bool Parse(Parser* parser, Scanner* scan, AST* ast) {
     CONTEXT(INFO, "Initialising new parser");
+    MEMORY_TAG(MEMORY_AST);
 
     parser->scanner = scan;
     parser->hadError = false;
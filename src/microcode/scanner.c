@@ -3,32 +3,57 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <pthread.h>
 #include "microcode/scanner.h"
 #include "shared/memory.h"
 #include "shared/platform.h"
+#include "shared/intern.h"
+#include "shared/table.h"
+#include "shared/log.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 static char peek(Scanner* scanner);
 static char advance(Scanner* scanner);
 static bool isAtEnd(Scanner* scanner);
 static bool isDigit(char c);
 static bool isIdent(char c);
+static void advanceTo(Scanner* scanner, const char* position);
 static void skipWhitespace(Scanner* scanner);
 static Token number(Scanner* scanner);
 static Token string(Scanner* scanner, char end);
 static Token identifier(Scanner* scanner);
 static MicrocodeTokenType identifierType(Scanner* scanner);
-static MicrocodeTokenType checkKeyword(Scanner* scanner, int start, int length,
-    const char* rest, MicrocodeTokenType type);
 static Token makeToken(Scanner* scanner, MicrocodeTokenType type);
 static Token errorToken(Scanner* scanner, const char* message);
 
-void ScannerInit(Scanner* scanner, const char* source, const char* fileName) {
+void ScannerInit(Scanner* scanner, const char* source, size_t length,
+    const char* fileName) {
     scanner->line = 1;
     scanner->column = 1;
+    scanner->startColumn = 1;
     scanner->current = source;
     scanner->start = source;
     scanner->base = source;
+    scanner->end = source + length;
     scanner->fileName = resolvePath(fileName);
+    registerSource(source, length);
+}
+
+unsigned int ScannerCountTokens(const Scanner* scanner) {
+    // string tokens are allocated, but not needed after counting
+    ArenaTemp temp = ArenaTempBegin();
+
+    Scanner copy = *scanner;
+    unsigned int count = 1;
+    while(ScanToken(&copy).type != TOKEN_EOF) {
+        count++;
+    }
+
+    ArenaTempEnd(temp);
+    return count;
 }
 
 Token ScanToken(Scanner* scanner){
@@ -37,9 +62,9 @@ Token ScanToken(Scanner* scanner){
 
     // scan current token from the end of the last token + whitespace
     scanner->start = scanner->current;
+    scanner->startColumn = scanner->column;
 
     if(isAtEnd(scanner)){
-        scanner->column++; // so EOF is in the column after the last token
         return makeToken(scanner, TOKEN_EOF);
     }
 
@@ -65,69 +90,106 @@ Token ScanToken(Scanner* scanner){
     return errorToken(scanner, "Unexpected character");
 }
 
-int getLineCount(const char* string) {
-    int lineCount = 1;
+// start offset of every line in a source, built the first time a line of
+// that source is requested
+typedef struct LineIndex {
+    ARRAY_DEFINE(unsigned int, start);
+    size_t length;
+    bool indexed;
+} LineIndex;
+
+// line indexes by source pointer, sources are never freed so the pointer
+// identifies the source
+static Table lineIndexes;
+static bool lineIndexesInitialized = false;
+static pthread_mutex_t lineIndexLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t sourceHash(void* value) {
+    uintptr_t ptr = (uintptr_t)value;
+    return (uint32_t)(ptr ^ ((uint64_t)ptr >> 32));
+}
 
-    for(int i = 0; string[i] != '\0'; i++) {
-        if(string[i] == '\n') {
-            lineCount++;
-        }
+static bool sourceCmp(void* a, void* b) {
+    return a == b;
+}
+
+// get the entry for a source, must be called with lineIndexLock held
+static LineIndex* findSource(const char* source) {
+    if(!lineIndexesInitialized) {
+        initTable(&lineIndexes, sourceHash, sourceCmp);
+        lineIndexesInitialized = true;
     }
 
-    return lineCount;
+    LineIndex* index;
+    if(!tableGet(&lineIndexes, (void*)source, (void**)&index)) {
+        index = ArenaAlloc(sizeof(LineIndex));
+        index->length = 0;
+        index->indexed = false;
+        tableSet(&lineIndexes, (void*)source, index);
+    }
+    return index;
 }
 
-bool getLine(const char* string, int line, int* start, int* length) {
-    // line that is being iterated over
-    int currentLine = 1;
-
-    // should the iteration stop at the next newline character
-    bool willEnd = false;
-
-    // length of the line that is being iterated over
-    int lineLength = 0;
-
-    for(int i = 0; string[i] != '\0'; i++) {
-        if(string[i] == '\n') {
-
-            // handle the line being requested being the first line
-            // which just ended
-            if(line == currentLine && line == 1) {
-                *start = 0;
-                *length = lineLength;
-                return true;
-            }
-            currentLine++;
-
-            // got to end of requested line
-            if(willEnd) {
-                *length = lineLength-1;
-                return true;
-            }
-
-            // start iterating over requested line
-            if(currentLine == line && !willEnd) {
-                *start = i+1;
-                willEnd = true;
-                lineLength = 1;
-            }
-        } else {
-            lineLength++;
+void registerSource(const char* source, size_t length) {
+    ARENA_PERSISTENT();
+    MEMORY_TAG(MEMORY_ERROR);
+
+    pthread_mutex_lock(&lineIndexLock);
+    LineIndex* index = findSource(source);
+    index->length = length;
+    pthread_mutex_unlock(&lineIndexLock);
+}
+
+static LineIndex* getLineIndex(const char* source) {
+    ARENA_PERSISTENT();
+    MEMORY_TAG(MEMORY_ERROR);
+
+    pthread_mutex_lock(&lineIndexLock);
+    LineIndex* index = findSource(source);
+    if(!index->indexed) {
+        CONTEXT(INFO, "Indexing source lines");
+
+        // a source that was never scanned has to be null terminated
+        if(index->length == 0) {
+            index->length = strlen(source);
+        }
+
+        ARRAY_ALLOC(unsigned int, *index, start);
+        ARRAY_PUSH(*index, start, 0);
+        const char* end = source + index->length;
+        for(const char* c = source; (c = memchr(c, '\n', end - c)) != NULL; c++) {
+            ARRAY_PUSH(*index, start, (unsigned int)(c + 1 - source));
         }
+        index->indexed = true;
     }
+    pthread_mutex_unlock(&lineIndexLock);
 
-    // handle the line requested being the last line of the string
-    if(willEnd) {
-        *length = lineLength;
-        return true;
+    return index;
+}
+
+int getLineCount(const char* string) {
+    return getLineIndex(string)->startCount;
+}
+
+bool getLine(const char* string, int line, int* start, int* length) {
+    LineIndex* index = getLineIndex(string);
+    if(line < 1 || (unsigned int)line > index->startCount) {
+        return false;
     }
 
-    // line requested not found in string given
-    return false;
+    // a line ends just before the next line's start, at its newline
+    unsigned int lineStart = index->starts[line - 1];
+    unsigned int lineEnd = (unsigned int)line < index->startCount ?
+        index->starts[line] - 1 : index->length;
+
+    *start = lineStart;
+    *length = lineEnd - lineStart;
+    return true;
 }
 
 // get next character without advancing the stream
 static char peek(Scanner* scanner) {
+    if(isAtEnd(scanner)) return '\0';
     return *scanner->current;
 }
 
@@ -141,7 +203,7 @@ static char advance(Scanner* scanner) {
 
 // are there more characters to read?
 static bool isAtEnd(Scanner* scanner) {
-    return *scanner->current == '\0';
+    return scanner->current >= scanner->end;
 }
 
 // is the character numerical?
@@ -159,62 +221,147 @@ static bool isIdent(char c) {
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
 }
 
-// ignore any ' ', '\t', '\r', '\n' and comments
+// move the scanner forward to position, which must be on the same line
+static void advanceTo(Scanner* scanner, const char* position) {
+    scanner->column += position - scanner->current;
+    scanner->current = position;
+}
+
+// sets of characters that can be skipped over in bulk
+typedef enum CharClass {
+    CLASS_IDENT,
+    CLASS_DIGIT,
+    CLASS_BINARY_DIGIT,
+    CLASS_SPACE
+} CharClass;
+
+static inline bool inClass(char c, CharClass class) {
+    switch(class) {
+        case CLASS_IDENT: return isIdent(c);
+        case CLASS_DIGIT: return isDigit(c);
+        case CLASS_BINARY_DIGIT: return isBinaryDigit(c);
+        case CLASS_SPACE: return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+    return false;
+}
+
+// most runs are shorter than this, so are checked one character at a time
+// before moving on to checking 16 characters at once
+#define SHORT_RUN 8
+
+#ifdef __SSE2__
+// is each byte in the range [low, high]
+static __m128i inRange(__m128i block, char low, char high) {
+    return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(low - 1)),
+        _mm_cmplt_epi8(block, _mm_set1_epi8(high + 1)));
+}
+
+// bitmask of the bytes in a block of 16 that are in the class
+static inline unsigned int classMask(__m128i block, CharClass class) {
+    __m128i match = _mm_setzero_si128();
+    switch(class) {
+        case CLASS_IDENT:
+            // setting bit 5 maps upper case letters onto lower case ones,
+            // no other character is mapped into the lower case range
+            match = _mm_or_si128(
+                inRange(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 'z'),
+                _mm_cmpeq_epi8(block, _mm_set1_epi8('_')));
+            break;
+        case CLASS_DIGIT:
+            match = inRange(block, '0', '9');
+            break;
+        case CLASS_BINARY_DIGIT:
+            match = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('0')),
+                _mm_cmpeq_epi8(block, _mm_set1_epi8('1')));
+            break;
+        case CLASS_SPACE:
+            match = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+                    _mm_cmpeq_epi8(block, _mm_set1_epi8('\t'))),
+                _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\r')),
+                    _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'))));
+            break;
+    }
+    return (unsigned int)_mm_movemask_epi8(match);
+}
+#endif
+
+// find the first character from current that is not in the class
+static inline const char* span(const char* current, const char* end, CharClass class) {
+    const char* shortEnd = end - current > SHORT_RUN ? current + SHORT_RUN : end;
+    while(current < shortEnd && inClass(*current, class)) {
+        current++;
+    }
+    if(current < shortEnd) {
+        return current;
+    }
+
+#ifdef __SSE2__
+    while(end - current >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)current);
+        // the bits above the block are set, so count is at most 16
+        unsigned int count = __builtin_ctz(~classMask(block, class));
+        current += count;
+        if(count < 16) {
+            return current;
+        }
+    }
+#endif
+    while(current < end && inClass(*current, class)) {
+        current++;
+    }
+    return current;
+}
+
+// ignore any ' ', '\t', '\r' and '\n'
+static void skipSpaces(Scanner* scanner) {
+    const char* end = span(scanner->current, scanner->end, CLASS_SPACE);
+
+    // the column restarts after the last newline skipped
+    for(const char* c = scanner->current; c < end; c++) {
+        if(*c == '\n') {
+            scanner->line++;
+            scanner->current = c + 1;
+            scanner->column = 1;
+        }
+    }
+    advanceTo(scanner, end);
+}
+
+// ignore any whitespace and comments
 static void skipWhitespace(Scanner* scanner) {
-    for(;;){
-        char c = peek(scanner);
-        switch(c) {
-            case ' ':
-            case '\t':
-            case '\r':
-                advance(scanner);
-                break;
-            case '\n':
-                scanner->line++;
-                scanner->column = 0;
-                advance(scanner);
-                break;
-            case '#':
-                // skip comment until just before end of line
-                while(peek(scanner) != '\n' && !isAtEnd(scanner)) {
-                    advance(scanner);
-                }
-                break;
-            default:
-                return;
+    for(;;) {
+        skipSpaces(scanner);
+        if(peek(scanner) != '#') {
+            return;
         }
+
+        // skip comment until just before end of line
+        const char* newline = memchr(scanner->current, '\n',
+            scanner->end - scanner->current);
+        advanceTo(scanner, newline != NULL ? newline : scanner->end);
     }
 }
 
 // scan a number
 static Token number(Scanner* scanner) {
     bool bin = false;
-    while(!isAtEnd(scanner)) {
-        if(!isDigit(peek(scanner))) {
-            break;
-        }
-        advance(scanner);
-    }
+    advanceTo(scanner, span(scanner->current, scanner->end, CLASS_DIGIT));
     if(scanner->current == scanner->start + 1 && scanner->current[-1] == '0' && peek(scanner) =='b') {
         bin = true;
         advance(scanner);
-        while(!isAtEnd(scanner)) {
-            if(!isBinaryDigit(peek(scanner))) {
-                break;
-            }
-            advance(scanner);
-        }
+        advanceTo(scanner, span(scanner->current, scanner->end,
+            CLASS_BINARY_DIGIT));
     }
 
-    char* endPtr;
-    long val;
-    if(bin) {
-        val = strtol(scanner->start + 2, &endPtr, 2);
-    } else {
-        val = strtol(scanner->start, &endPtr, 10);
-    }
-    if(val > INT_MAX) {
-        return errorToken(scanner, "Number too large for integer type");
+    // the source is not null terminated, so cannot be passed to strtol
+    int base = bin ? 2 : 10;
+    long long val = 0;
+    for(const char* c = scanner->start + (bin ? 2 : 0); c < scanner->current; c++) {
+        val = val * base + (*c - '0');
+        if(val > INT_MAX) {
+            return errorToken(scanner, "Number too large for integer type");
+        }
     }
 
     Token out = makeToken(scanner, bin ? TOKEN_BINARY : TOKEN_NUMBER);
@@ -223,50 +370,50 @@ static Token number(Scanner* scanner) {
 }
 
 static Token string(Scanner* scanner, char end) {
-    while(!isAtEnd(scanner)) {
-        char c = advance(scanner);
-        if(c == end) {
-            break;
-        }
-    }
+    const char* close = memchr(scanner->current, end,
+        scanner->end - scanner->current);
+    advanceTo(scanner, close != NULL ? close + 1 : scanner->end);
 
+    // content without the quotes, an unterminated string is cut short
     Token ret = makeToken(scanner, TOKEN_STRING);
-    char* buf = ArenaAlloc(sizeof(char) * (ret.range.length-2+1));
-    *buf = '\0';
-    strncat(buf, ret.range.tokenStart+1, ret.range.length-2);
+    int length = ret.range.length >= 2 ? ret.range.length - 2 : 0;
+    char* buf = ArenaAlloc(sizeof(char) * (length + 1));
+    memcpy(buf, ret.range.tokenStart + 1, length);
+    buf[length] = '\0';
     ret.data.string = buf;
     return ret;
 }
 
 // scan an identifier
 static Token identifier(Scanner* scanner) {
-    while(isIdent(peek(scanner))) {
-        advance(scanner);
-    }
-
+    advanceTo(scanner, span(scanner->current, scanner->end, CLASS_IDENT));
     return makeToken(scanner, identifierType(scanner));
 }
 
+typedef struct Keyword {
+    const char* name;
+    int length;
+    MicrocodeTokenType type;
+} Keyword;
+
+// keywords indexed by a perfect hash of their first character, the low 3
+// bits of the first character of every keyword are different
+#define KEYWORD_HASH(c) ((unsigned char)(c) & 7)
+static const Keyword keywords[8] = {
+    [KEYWORD_HASH('b')] = {"bitgroup", 8, TOKEN_BITGROUP},
+    [KEYWORD_HASH('e')] = {"enum", 4, TOKEN_ENUM},
+    [KEYWORD_HASH('h')] = {"header", 6, TOKEN_HEADER},
+    [KEYWORD_HASH('i')] = {"include", 7, TOKEN_INCLUDE},
+    [KEYWORD_HASH('o')] = {"opcode", 6, TOKEN_OPCODE},
+    [KEYWORD_HASH('t')] = {"type", 4, TOKEN_TYPE},
+};
+
 // what is the token type of the last identifier scanned?
 static MicrocodeTokenType identifierType(Scanner* scanner) {
-    // uses a trie
-    switch(scanner->start[0]) {
-        case 'b': return checkKeyword(scanner, 1, 7, "itgroup", TOKEN_BITGROUP);
-        case 'e': return checkKeyword(scanner, 1, 3, "num", TOKEN_ENUM);
-        case 'h': return checkKeyword(scanner, 1, 5, "eader", TOKEN_HEADER);
-        case 'i': return checkKeyword(scanner, 1, 6, "nclude", TOKEN_INCLUDE);
-        case 'o': return checkKeyword(scanner, 1, 5, "pcode", TOKEN_OPCODE);
-        case 't': return checkKeyword(scanner, 1, 3, "ype", TOKEN_TYPE);
-    }
-    return TOKEN_IDENTIFIER;
-}
-
-// is the remainder of the last scanned identifier the same as the provided string
-static MicrocodeTokenType checkKeyword(Scanner* scanner, int start, int length,
-      const char* rest, MicrocodeTokenType type) {
-    if(scanner->current - scanner->start == start + length &&
-          memcmp(scanner->start + start, rest, length) == 0) {
-        return type;
+    const Keyword* keyword = &keywords[KEYWORD_HASH(scanner->start[0])];
+    if(keyword->length == scanner->current - scanner->start &&
+       memcmp(scanner->start, keyword->name, keyword->length) == 0) {
+        return keyword->type;
     }
     return TOKEN_IDENTIFIER;
 }
@@ -278,11 +425,12 @@ static Token makeToken(Scanner* scanner, MicrocodeTokenType type) {
     token.range.tokenStart = scanner->start;
     token.range.length = (int)(scanner->current - scanner->start);
     token.range.line = scanner->line;
-    token.range.column = scanner->column;
+    token.range.column = scanner->startColumn;
     token.range.filename = scanner->fileName;
     token.range.sourceStart = scanner->base;
     if(type == TOKEN_IDENTIFIER) {
-        token.data.string = tokenAllocName(&token);
+        token.data.string = internString(token.range.tokenStart,
+            token.range.length);
     }
 
     return token;
@@ -295,7 +443,7 @@ static Token errorToken(Scanner* scanner, const char* message) {
     token.range.tokenStart = scanner->start;
     token.range.length = (int)(scanner->current - scanner->start);
     token.range.line = scanner->line;
-    token.range.column = scanner->column;
+    token.range.column = scanner->startColumn;
     token.range.filename = scanner->fileName;
     token.range.sourceStart = scanner->base;
     token.data.string = message;
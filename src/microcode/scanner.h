@@ -2,29 +2,49 @@
 #define SCANNER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "microcode/token.h"
 
 // scanner current source infomation
 typedef struct Scanner {
     const char* base;
+    const char* end;
     const char* fileName;
     const char* current;
     const char* start;
     int line;
     int column;
+
+    // column of the token currently being scanned
+    int startColumn;
 } Scanner;
 
-// initialise (or re-initialise) an already existing scanner
-void ScannerInit(Scanner* scanner, const char* source, const char* fileName);
+// initialise (or re-initialise) an already existing scanner, source is length
+// characters long and does not have to be null terminated
+void ScannerInit(Scanner* scanner, const char* source, size_t length,
+    const char* fileName);
 
 // get the next token from a scanner
 Token ScanToken(Scanner* scanner);
 
-// get the start position and the length of the
-// nth line in a string, by iteration (eg O(N))
+// scan the rest of the source without moving the scanner on, used to measure
+// how long scanning takes.  returns the number of tokens, including the end
+unsigned int ScannerCountTokens(const Scanner* scanner);
+
+// get the start position and the length of the nth line (from 1) in a
+// source.  The first call for a source indexes its lines, later calls are
+// O(1), so the source must not be freed.  The source must have been scanned
+// or be null terminated.
 // returns whether the line was found
 // if not, start and length might be invalid
 // sets start and length to output values
 bool getLine(const char* string, int line, int* start, int* length);
 
+// record the length of a source that is not null terminated, so getLine can
+// be used on it.  Done by ScannerInit for every source scanned
+void registerSource(const char* source, size_t length);
+
+// number of lines in a source, indexed in the same way as getLine
+int getLineCount(const char* string);
+
 #endif
@@ -3,46 +3,506 @@
 #include <stdlib.h>
 
 #include "shared/platform.h"
+#include "shared/buffer.h"
+#include "shared/path.h"
+#include "shared/thread.h"
+#include "shared/log.h"
+#include "shared/timeReport.h"
 #include "emulator/compiletime/template.h"
+#include "emulator/compiletime/coreCache.h"
 #include "microcode/test.h"
 #include "microcode/error.h"
 #include "microcode/analyse.h"
 #include "microcode/scanner.h"
 #include "microcode/parser.h"
 
-// TODO: re-implement microcode parser test suite
-// TODO: re-write microcode tests
-
-inline bool runFileName(const char* fileName) {
+typedef struct FileAnalysis {
+    const char* fileName;
+    Parser parser;
     AST ast;
-    return runFile(fileName, readFile(fileName), &ast);
-}
 
-bool runFile(const char* fileName, const char* file, AST* ast) {
+    // message to print instead of the errors, if the file was not analysed
+    const char* failure;
+} FileAnalysis;
+
+typedef struct BatchAnalysis {
+    ARRAY_DEFINE(FileAnalysis, file);
+    const char* cacheDir;
+} BatchAnalysis;
+
+static void analyseFile(void* data, unsigned int index) {
+    BatchAnalysis* batch = data;
+    FileAnalysis* analysis = &batch->files[index];
+    const char* fileName = analysis->fileName;
+    CONTEXT(INFO, "Analysing %s", fileName);
+
+    FileBuffer file;
+    if(!mapFile(fileName, &file)) {
+        analysis->failure = aprintf("Could not read file \"%s\"\n", fileName);
+        return;
+    }
+
     const char* fullFileName = resolvePath(fileName);
 
     Scanner scan;
-    Parser parse;
-    ScannerInit(&scan, file, fullFileName);
-    InitAST(ast);
+    ScannerInit(&scan, file.data, file.length, fullFileName);
+    InitAST(&analysis->ast);
 
     const char* ext = strrchr(fullFileName, '.');
     if(!ext) {
-        cErrPrintf(TextRed, "\nCould not detect file type for \"%s\"\n", fullFileName);
-        return false;
+        analysis->failure = aprintf(
+            "\nCould not detect file type for \"%s\"\n", fullFileName);
+        return;
     } else {
         ext = ext + 1;
     }
 
-    if(!strcmp(ext, "uasm")) {
-        Parse(&parse, &scan, ast);
-        VMCoreGen core;
+    if(strcmp(ext, "uasm")) {
+        analysis->failure = aprintf(
+            "\nUnknown file type \"%s\" when reading file \"%s\"\n", ext,
+            fullFileName);
+        return;
+    }
+
+    VMCoreGen core;
+    StageTimer timer = stageBegin();
+    if(batch->cacheDir != NULL && coreCacheLoad(batch->cacheDir, fileName,
+       &core, &analysis->parser, &analysis->ast)) {
+        stageEnd(&timer, "cache", 1, "files");
+    } else {
+        if(timeReportEnabled()) {
+            unsigned int tokens = ScannerCountTokens(&scan);
+            stageEnd(&timer, "scan", tokens, "tokens");
+        }
+
+        timer = stageBegin();
+        Parse(&analysis->parser, &scan, &analysis->ast);
+        stageEnd(&timer, "parse", analysis->ast.statementCount, "statements");
+
+        timer = stageBegin();
         createEmulator(&core);
-        Analyse(&parse, &core);
-        printErrors(&parse);
-        return true;
+        stageEnd(&timer, "template", core.commandCount, "commands");
+
+        Analyse(&analysis->parser, &core);
+        if(batch->cacheDir != NULL) {
+            coreCacheStore(batch->cacheDir, fileName, &core, &analysis->parser,
+                &analysis->ast);
+        }
+    }
+}
+
+static void addFile(BatchAnalysis* batch, const char* fileName) {
+    FileAnalysis analysis;
+    analysis.fileName = fileName;
+    analysis.failure = NULL;
+    ARRAY_PUSH(*batch, file, analysis);
+}
+
+static void addDirectoryFile(const char* path, void* data) {
+    const char* ext = pathGetExtension(path);
+    if(ext != NULL && strcmp(ext, "uasm") == 0) {
+        addFile(data, path);
+    }
+}
+
+static int fileNameSort(const void* a, const void* b) {
+    return strcmp(((const FileAnalysis*)a)->fileName,
+        ((const FileAnalysis*)b)->fileName);
+}
+
+bool runFileNames(const char** paths, unsigned int pathCount,
+    const char* cacheDir) {
+    CONTEXT(INFO, "Analysing %u paths", pathCount);
+
+    BatchAnalysis batch;
+    batch.cacheDir = cacheDir;
+    ARRAY_ALLOC(FileAnalysis, batch, file);
+
+    // files in a directory are listed in an arbitrary order, sort them so
+    // the output does not depend on the file system
+    for(unsigned int i = 0; i < pathCount; i++) {
+        unsigned int first = batch.fileCount;
+        if(iterateDirectory(paths[i], addDirectoryFile, &batch)) {
+            qsort(&batch.files[first], batch.fileCount - first,
+                sizeof(FileAnalysis), fileNameSort);
+        } else {
+            addFile(&batch, paths[i]);
+        }
+    }
+
+    INFO("Found %u files", batch.fileCount);
+    parallelFor(batch.fileCount, analyseFile, &batch);
+
+    // printed once every file is done, in the order they were given
+    bool success = true;
+    for(unsigned int i = 0; i < batch.fileCount; i++) {
+        FileAnalysis* analysis = &batch.files[i];
+        bool hasMessages = analysis->failure != NULL ||
+            analysis->parser.errorCount > 0;
+        if(batch.fileCount > 1 && hasMessages) {
+            cErrPrintf(TextWhite, "%s:\n", analysis->fileName);
+        }
+
+        if(analysis->failure != NULL) {
+            cErrPrintf(TextRed, "%s", analysis->failure);
+            success = false;
+        } else {
+            printErrors(&analysis->parser);
+        }
+    }
+
+    return success;
+}
+
+bool runFileName(const char* fileName, const char* cacheDir) {
+    return runFileNames(&fileName, 1, cacheDir);
+}
+
+// Test files contain the diagnostics they are expected to produce followed by
+// the microcode to analyse, seperated by an empty line.  Each expectation is a
+// line with E for an error or W for a warning, where it is reported relative
+// to the start of the microcode, then the first line of its message and how
+// many times it was found, if more than once:
+//   E 6:10; Expected opcode number, got NUMBER
+//   W 2:1; Unable to order microcode bits (found 4 times)
+//
+//   opcode hi a() {}
+
+typedef struct Diagnostic {
+    char kind;
+    int line;
+    int column;
+
+    // first line of the message
+    const char* message;
+    TextColor color;
+} Diagnostic;
+
+typedef struct TestFile {
+    const char* fileName;
+    double time;
+    bool passed;
+
+    // everything after the expectations, to keep when blessing the file
+    const char* source;
+    size_t sourceLength;
+
+    ARRAY_DEFINE(Diagnostic, expected);
+    ARRAY_DEFINE(Diagnostic, actual);
+
+    // message to print instead of comparing diagnostics, if the test could
+    // not be run
+    const char* failure;
+} TestFile;
+
+typedef struct TestRun {
+    ARRAY_DEFINE(TestFile, test);
+} TestRun;
+
+static int diagnosticSort(const void* a, const void* b) {
+    const Diagnostic* diagA = a;
+    const Diagnostic* diagB = b;
+    if(diagA->line != diagB->line) {
+        return diagA->line < diagB->line ? -1 : 1;
+    }
+    if(diagA->column != diagB->column) {
+        return diagA->column < diagB->column ? -1 : 1;
+    }
+    if(diagA->kind != diagB->kind) {
+        return diagA->kind - diagB->kind;
+    }
+    return strcmp(diagA->message, diagB->message);
+}
+
+// read one number from an expectation, returns false if there was none
+static bool expectationNumber(const char** current, const char* end,
+    int* value) {
+    const char* c = *current;
+    if(c >= end || *c < '0' || *c > '9') {
+        return false;
+    }
+    *value = 0;
+    while(c < end && *c >= '0' && *c <= '9' && *value < 100000000) {
+        *value = *value * 10 + (*c - '0');
+        c++;
+    }
+    *current = c;
+    return true;
+}
+
+// parse an expectation line, returns false if the line is not an expectation
+static bool parseExpectation(const char* line, const char* end,
+    Diagnostic* diagnostic) {
+    if(end - line < 2 || (line[0] != 'E' && line[0] != 'W') ||
+       line[1] != ' ') {
+        return false;
+    }
+    diagnostic->kind = line[0];
+    diagnostic->color = TextWhite;
+    line += 2;
+
+    if(!(expectationNumber(&line, end, &diagnostic->line) &&
+         line < end && *line++ == ':' &&
+         expectationNumber(&line, end, &diagnostic->column) &&
+         line < end && *line++ == ';' && line < end && *line++ == ' ' &&
+         line < end)) {
+        return false;
+    }
+    diagnostic->message = aprintf("%.*s", (int)(end - line), line);
+    return true;
+}
+
+// split a test file into its expectations and the microcode following them
+static void parseTestFile(TestFile* test, const FileBuffer* file) {
+    const char* current = file->data;
+    const char* end = file->data + file->length;
+
+    while(current < end) {
+        const char* lineEnd = memchr(current, '\n', end - current);
+        if(lineEnd == NULL) {
+            lineEnd = end;
+        }
+        const char* contentEnd = lineEnd;
+        if(contentEnd > current && contentEnd[-1] == '\r') {
+            contentEnd--;
+        }
+
+        Diagnostic diagnostic;
+        if(parseExpectation(current, contentEnd, &diagnostic)) {
+            ARRAY_PUSH(*test, expected, diagnostic);
+            current = lineEnd < end ? lineEnd + 1 : end;
+            continue;
+        }
+
+        // the empty line seperating the expectations from the microcode
+        if(test->expectedCount > 0 && contentEnd == current) {
+            current = lineEnd < end ? lineEnd + 1 : end;
+        }
+        break;
+    }
+
+    test->source = current;
+    test->sourceLength = end - current;
+}
+
+static void runTest(void* data, unsigned int index) {
+    TestRun* run = data;
+    TestFile* test = &run->tests[index];
+    CONTEXT(INFO, "Running test %s", test->fileName);
+
+    double start = monotonicTime();
+
+    FileBuffer file;
+    if(!mapFile(test->fileName, &file)) {
+        test->failure = aprintf("Could not read file \"%s\"\n",
+            test->fileName);
+        return;
+    }
+    parseTestFile(test, &file);
+
+    Scanner scan;
+    Parser parser;
+    AST ast;
+    VMCoreGen core;
+    ScannerInit(&scan, test->source, test->sourceLength,
+        resolvePath(test->fileName));
+    InitAST(&ast);
+    Parse(&parser, &scan, &ast);
+    createEmulator(&core);
+    Analyse(&parser, &core);
+
+    // reported where the first source location in each message is
+    for(unsigned int i = 0; i < parser.errorCount; i++) {
+        Error* err = parser.errors[i];
+        Diagnostic diagnostic;
+        diagnostic.kind = err->severity == ERROR_WARN ? 'W' : 'E';
+        diagnostic.line = 0;
+        diagnostic.column = 0;
+        diagnostic.message = "";
+        diagnostic.color = TextWhite;
+        bool hasMessage = false;
+        for(unsigned int j = 0; j < err->chunkCount; j++) {
+            ErrorChunk* chunk = &err->chunks[j];
+            if(chunk->type == ERROR_CHUNK_TEXT && !hasMessage) {
+                const char* message = chunk->as.text.message;
+                const char* newline = strchr(message, '\n');
+                diagnostic.message = newline == NULL ? message :
+                    aprintf("%.*s", (int)(newline - message), message);
+                diagnostic.color = chunk->as.text.color;
+                hasMessage = true;
+            } else if(chunk->type == ERROR_CHUNK_SOURCE) {
+                diagnostic.line = chunk->as.source.line;
+                diagnostic.column = chunk->as.source.column;
+                break;
+            }
+        }
+        if(err->instanceTotal > 1) {
+            diagnostic.message = aprintf("%s (found %u times)",
+                diagnostic.message, err->instanceTotal);
+        }
+        ARRAY_PUSH(*test, actual, diagnostic);
+    }
+
+    qsort(test->expecteds, test->expectedCount, sizeof(Diagnostic),
+        diagnosticSort);
+    qsort(test->actuals, test->actualCount, sizeof(Diagnostic),
+        diagnosticSort);
+
+    test->passed = test->expectedCount == test->actualCount;
+    for(unsigned int i = 0; test->passed && i < test->actualCount; i++) {
+        test->passed = diagnosticSort(&test->expecteds[i],
+            &test->actuals[i]) == 0;
+    }
+
+    test->time = monotonicTime() - start;
+}
+
+// replace a test's expectations with the diagnostics it produced
+static bool blessTest(TestFile* test) {
+    Buffer output;
+    bufferInit(&output);
+    for(unsigned int i = 0; i < test->actualCount; i++) {
+        Diagnostic* diagnostic = &test->actuals[i];
+        bufferPrintf(&output, "%c %d:%d; %s\n", diagnostic->kind,
+            diagnostic->line, diagnostic->column, diagnostic->message);
+    }
+    if(test->actualCount > 0) {
+        bufferPutc(&output, '\n');
+    }
+    bufferWrite(&output, test->source, test->sourceLength);
+
+    return writeFileIfChanged(test->fileName, output.chars, output.charCount);
+}
+
+static void addTest(TestRun* run, const char* fileName) {
+    TestFile test;
+    test.fileName = fileName;
+    test.time = 0;
+    test.passed = false;
+    test.source = NULL;
+    test.sourceLength = 0;
+    test.failure = NULL;
+    ARRAY_ALLOC(Diagnostic, test, expected);
+    ARRAY_ALLOC(Diagnostic, test, actual);
+    ARRAY_PUSH(*run, test, test);
+}
+
+static void addDirectoryTest(const char* path, void* data) {
+    const char* ext = pathGetExtension(path);
+    if(ext != NULL && strcmp(ext, "uasmt") == 0) {
+        addTest(data, path);
+    }
+}
+
+static int testNameSort(const void* a, const void* b) {
+    return strcmp(((const TestFile*)a)->fileName,
+        ((const TestFile*)b)->fileName);
+}
+
+static int testTimeSort(const void* a, const void* b) {
+    double timeA = (*(TestFile* const*)a)->time;
+    double timeB = (*(TestFile* const*)b)->time;
+    return (timeA < timeB) - (timeA > timeB);
+}
+
+static void printDiagnostics(const char* title, Diagnostic* diagnostics,
+    unsigned int count) {
+    cOutPrintf(TextWhite, "  %s:\n", title);
+    if(count == 0) {
+        cOutPrintf(TextWhite, "    nothing\n");
+    }
+    for(unsigned int i = 0; i < count; i++) {
+        Diagnostic* diagnostic = &diagnostics[i];
+        cOutPrintf(TextWhite, "    %c %d:%d; ", diagnostic->kind,
+            diagnostic->line, diagnostic->column);
+        cOutPrintf(diagnostic->color, "%s", diagnostic->message);
+        cOutPrintf(TextWhite, "\n");
+    }
+}
+
+bool runTests(const char** paths, unsigned int pathCount, bool bless,
+    unsigned int slowest) {
+    CONTEXT(INFO, "Running tests");
+
+    TestRun run;
+    ARRAY_ALLOC(TestFile, run, test);
+    for(unsigned int i = 0; i < pathCount; i++) {
+        unsigned int first = run.testCount;
+        if(iterateDirectory(paths[i], addDirectoryTest, &run)) {
+            qsort(&run.tests[first], run.testCount - first, sizeof(TestFile),
+                testNameSort);
+        } else {
+            addTest(&run, paths[i]);
+        }
+    }
+
+    double start = monotonicTime();
+    parallelFor(run.testCount, runTest, &run);
+    double time = monotonicTime() - start;
+
+    unsigned int passed = 0;
+    unsigned int failed = 0;
+    for(unsigned int i = 0; i < run.testCount; i++) {
+        TestFile* test = &run.tests[i];
+
+        if(test->failure != NULL) {
+            cOutPrintf(TextRed, "FAIL ");
+            cOutPrintf(TextWhite, "%s\n", test->fileName);
+            cOutPrintf(TextRed, "  %s", test->failure);
+            failed++;
+            continue;
+        }
+
+        if(bless && !test->passed) {
+            if(blessTest(test)) {
+                cOutPrintf(TextYellow, "BLESS ");
+                cOutPrintf(TextWhite, "%s\n", test->fileName);
+                passed++;
+            } else {
+                cOutPrintf(TextRed, "FAIL ");
+                cOutPrintf(TextWhite, "%s\n", test->fileName);
+                cOutPrintf(TextRed, "  Could not write file \"%s\"\n",
+                    test->fileName);
+                failed++;
+            }
+            continue;
+        }
+
+        if(test->passed) {
+            cOutPrintf(TextGreen, "PASS ");
+            cOutPrintf(TextWhite, "%s (%.2fms)\n", test->fileName,
+                test->time * 1000);
+            passed++;
+        } else {
+            cOutPrintf(TextRed, "FAIL ");
+            cOutPrintf(TextWhite, "%s (%.2fms)\n", test->fileName,
+                test->time * 1000);
+            printDiagnostics("expected", test->expecteds, test->expectedCount);
+            printDiagnostics("got", test->actuals, test->actualCount);
+            failed++;
+        }
+    }
+
+    cOutPrintf(failed > 0 ? TextRed : TextGreen,
+        "\n%u passed, %u failed in %.2fms\n", passed, failed, time * 1000);
+
+    // the slowest tests point out diagnostics that have become expensive
+    if(slowest > 0 && run.testCount > 0) {
+        TestFile** byTime = ArenaAlloc(sizeof(TestFile*) * run.testCount);
+        for(unsigned int i = 0; i < run.testCount; i++) {
+            byTime[i] = &run.tests[i];
+        }
+        qsort(byTime, run.testCount, sizeof(TestFile*), testTimeSort);
+
+        if(slowest > run.testCount) {
+            slowest = run.testCount;
+        }
+        cOutPrintf(TextWhite, "Slowest %u:\n", slowest);
+        for(unsigned int i = 0; i < slowest; i++) {
+            cOutPrintf(TextWhite, "  %8.2fms %s\n", byTime[i]->time * 1000,
+                byTime[i]->fileName);
+        }
     }
 
-    cErrPrintf(TextRed, "\nUnknown file type \"%s\" when reading file \"%s\"\n", ext, fullFileName);
-    return false;
+    return failed == 0;
 }
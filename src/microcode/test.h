@@ -1,10 +1,25 @@
 #ifndef TEST_H
 #define TEST_H
 
+#include "shared/platform.h"
 #include "microcode/token.h"
 #include "microcode/ast.h"
 
-bool runFileName(const char* fileName);
-bool runFile(const char* fileName, const char* file, AST* ast);
+// parse and analyse a file, using and updating the analysed cores saved in
+// cacheDir if it is not NULL
+bool runFileName(const char* fileName, const char* cacheDir);
+
+// parse and analyse files in parallel, every .uasm file is analysed for paths
+// that are directories.  The messages for each file are printed together, in
+// the order the files were given, with the files in a directory sorted by name
+bool runFileNames(const char** paths, unsigned int pathCount,
+    const char* cacheDir);
+
+// run every .uasmt test file in paths, directories are searched for them, and
+// compare the diagnostics each produces with those it expects.  Blessing
+// replaces the expectations of failing tests with what they produced.  Prints
+// the time taken by the slowest tests
+bool runTests(const char** paths, unsigned int pathCount, bool bless,
+    unsigned int slowest);
 
 #endif
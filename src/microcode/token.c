@@ -2,6 +2,7 @@
 #include <string.h>
 #include "shared/memory.h"
 #include "microcode/token.h"
+#include "shared/intern.h"
 
 #define STRING_TOKEN(x) #x,
 
@@ -43,32 +44,15 @@ Token* createUIntTokenPtr(unsigned int num) {
     return t;
 }
 
-// FNV-1a
+// identifier tokens are interned by the scanner, so hash and compare the atom
+// rather than the characters
 uint32_t tokenHash(void* value) {
     Token* token = value;
-    uint32_t hash = 2166126261u;
-
-    for(int i = 0; i < token->range.length; i++) {
-        hash ^= token->range.tokenStart[i];
-        hash *= 16777619;
-    }
-
-    return hash;
+    return atomHash((void*)token->data.string);
 }
 
 bool tokenCmp(void* a, void* b) {
     Token* tokA = a;
     Token* tokB = b;
-
-    if(tokA->range.length != tokB->range.length) {
-        return false;
-    }
-    return strncmp(tokA->range.tokenStart, tokB->range.tokenStart, tokA->range.length) == 0;
+    return tokA->data.string == tokB->data.string;
 }
-
-const char* tokenAllocName(Token* tok) {
-    char* ret = ArenaAlloc(sizeof(char) * tok->range.length + 1);
-    strncpy(ret, tok->range.tokenStart, tok->range.length);
-    ret[tok->range.length] = '\0';
-    return ret;
-}
\ No newline at end of file
@@ -21,7 +21,7 @@ typedef enum MicrocodeTokenType {
     FOREACH_TOKEN(ENUM_TOKEN)
 } MicrocodeTokenType;
 
-const char* TokenNames[FOREACH_TOKEN(ADD_TOKEN)];
+extern const char* TokenNames[FOREACH_TOKEN(ADD_TOKEN)];
 
 #undef ENUM_TOKEN
 #undef ADD_TOKEN
@@ -56,6 +56,5 @@ Token* createUIntTokenPtr(unsigned int num);
 
 uint32_t tokenHash(void* value);
 bool tokenCmp(void* a, void* b);
-const char* tokenAllocName(Token* tok);
 
 #endif
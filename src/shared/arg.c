@@ -116,9 +116,9 @@ static void argUsage(argParser* parser) {
         ARRAY_ALLOC(char, shortOpts, char);
 
         // gather single character options without an argument
-        for(unsigned int i = 0; i < parser->options.entryCapacity; i++) {
-            Entry2* entry = &parser->options.entrys[i];
-            if(entry->key.key == NULL) {
+        for(unsigned int i = 0; i < parser->options.capacity; i++) {
+            Entry* entry = &parser->options.entries[i];
+            if(entry->key.value == NULL) {
                 continue;
             }
             optionArg* arg = entry->value;
@@ -139,9 +139,9 @@ static void argUsage(argParser* parser) {
         // print options with a short name that take an argument
         charOptArr shortArgOpts;
         ARRAY_ALLOC(charOpt, shortArgOpts, option);
-        for(unsigned int i = 0; i < parser->options.entryCapacity; i++) {
-            Entry2* entry = &parser->options.entrys[i];
-            if(entry->key.key == NULL) {
+        for(unsigned int i = 0; i < parser->options.capacity; i++) {
+            Entry* entry = &parser->options.entries[i];
+            if(entry->key.value == NULL) {
                 continue;
             }
             optionArg* arg = entry->value;
@@ -167,9 +167,9 @@ static void argUsage(argParser* parser) {
         // print options without a short name that take an argument
         strOptArr longArgOpts;
         ARRAY_ALLOC(strOpt, longArgOpts, option);
-        for(unsigned int i = 0; i < parser->options.entryCapacity; i++) {
-            Entry2* entry = &parser->options.entrys[i];
-            if(entry->key.key == NULL) {
+        for(unsigned int i = 0; i < parser->options.capacity; i++) {
+            Entry* entry = &parser->options.entries[i];
+            if(entry->key.value == NULL) {
                 continue;
             }
             optionArg* arg = entry->value;
@@ -195,12 +195,13 @@ static void argUsage(argParser* parser) {
         // prints positional arguments
         for(unsigned int i = 0; i < parser->posArgCount; i++) {
             posArg* arg = &parser->posArgs[i];
-            int length = strlen(arg->description) + 2;
+            int length = strlen(arg->description) + (arg->repeated ? 5 : 2);
             if(length + currentLength > 80) {
                 cErrPrintf(TextWhite, "\n  ");
                 currentLength = 2;
             }
-            cErrPrintf(TextWhite, "<%s> ", arg->description);
+            cErrPrintf(TextWhite, "<%s>%s ", arg->description,
+                arg->repeated ? "..." : "");
             currentLength += length + 1;
         }
 
@@ -212,9 +213,9 @@ static void argUsage(argParser* parser) {
     ARRAY_ALLOC(argParser*, parsers, parser);
 
     // gather all sub-parsers
-    for(unsigned int i = 0; i < parser->modes.entryCapacity; i++) {
-        Entry2* entry = &parser->modes.entrys[i];
-        if(entry->key.key == NULL) {
+    for(unsigned int i = 0; i < parser->modes.capacity; i++) {
+        Entry* entry = &parser->modes.entries[i];
+        if(entry->key.value == NULL) {
             continue;
         }
         ARRAY_PUSH(parsers, parser, entry->value);
@@ -300,16 +301,17 @@ static void argHelp(argParser* parser) {
     if(parser->printUsage) {
         for(unsigned int i = 0; i < parser->posArgCount; i++) {
             posArg* arg = &parser->posArgs[i];
-            cErrPrintf(TextWhite, "  <%s>\n", arg->description);
+            cErrPrintf(TextWhite, "  <%s>%s\n", arg->description,
+                arg->repeated ? "..." : "");
             printWordWrap("    ", arg->helpMessage);
         }
 
         // print option help
         optionArgArr args;
         ARRAY_ALLOC(optionArg, args, option);
-        for(unsigned int i = 0; i < parser->options.entryCapacity; i++) {
-            Entry2* entry = &parser->options.entrys[i];
-            if(entry->key.key == NULL) {
+        for(unsigned int i = 0; i < parser->options.capacity; i++) {
+            Entry* entry = &parser->options.entries[i];
+            if(entry->key.value == NULL) {
                 continue;
             }
             optionArg* arg = entry->value;
@@ -364,9 +366,9 @@ static void argHelp(argParser* parser) {
     ARRAY_ALLOC(argParser*, parsers, parser);
 
     // gather all sub-parsers
-    for(unsigned int i = 0; i < parser->modes.entryCapacity; i++) {
-        Entry2* entry = &parser->modes.entrys[i];
-        if(entry->key.key == NULL) {
+    for(unsigned int i = 0; i < parser->modes.capacity; i++) {
+        Entry* entry = &parser->modes.entries[i];
+        if(entry->key.value == NULL) {
             continue;
         }
         ARRAY_PUSH(parsers, parser, entry->value);
@@ -436,8 +438,8 @@ void argArguments(argParser* parser, int argc, char** argv) {
 }
 
 void argInit(argParser* parser, const char* name) {
-    TABLE2_INIT(parser->modes, hashstr, cmpstr, const char*, argParser*);
-    TABLE2_INIT(parser->options, hashstr, cmpstr, const char*, optionArg*);
+    initTable(&parser->modes, strHash, strCmp);
+    initTable(&parser->options, strHash, strCmp);
     ARRAY_ALLOC(posArg, *parser, posArg);
     ARRAY_ALLOC(const char*, *parser, errorMessage);
     ARRAY_ALLOC(optionArg*, *parser, universalOption);
@@ -463,7 +465,7 @@ void argInit(argParser* parser, const char* name) {
 
 optionArg* argOption(argParser* parser, char shortName, const char* longName) {
     // error checking for the names
-    if(TABLE2_HAS(parser->options, longName)) {
+    if(tableHas(&parser->options, (void*)longName)) {
         argInternalError(parser, "Option %s already exists", longName);
     }
 
@@ -490,7 +492,7 @@ optionArg* argOption(argParser* parser, char shortName, const char* longName) {
     arg->printed = false;
 
     // add it to the table of options
-    TABLE2_SET(parser->options, longName, arg);
+    tableSet(&parser->options, (void*)longName, arg);
     return arg;
 }
 
@@ -510,12 +512,12 @@ optionArg* argOptionInt(argParser* parser, char shortName, const char* longName)
 
 void argAddExistingOption(argParser* parser, optionArg* arg) {
     // error checking for the names
-    if(TABLE2_HAS(parser->options, arg->longName)) {
+    if(tableHas(&parser->options, (void*)arg->longName)) {
         argInternalError(parser, "Option %s already exists", arg->longName);
     }
 
     // add it to the table of options
-    TABLE2_SET(parser->options, arg->longName, arg);
+    tableSet(&parser->options, (void*)arg->longName, arg);
 }
 
 optionArg* argUniversalOption(argParser* parser, char shortName, const char* longName, bool childrenOnly) {
@@ -526,7 +528,7 @@ optionArg* argUniversalOption(argParser* parser, char shortName, const char* lon
 
     ARRAY_PUSH(*parser, universalOption, arg);
     if(childrenOnly) {
-        TABLE2_REMOVE(parser->options, longName);
+        tableRemove(&parser->options, (void*)longName);
     }
 
     return arg;
@@ -548,7 +550,7 @@ optionArg* argUniversalOptionInt(argParser* parser, char shortName, const char*
 
 argParser* argMode(argParser* parser, const char* name) {
     // error checking
-    if(TABLE2_HAS(parser->modes, name)) {
+    if(tableHas(&parser->modes, (void*)name)) {
         argInternalError(parser, "Mode already exists");
     }
 
@@ -570,10 +572,10 @@ argParser* argMode(argParser* parser, const char* name) {
     for(unsigned int i = 0; i < parser->universalOptionCount; i++) {
         optionArg* arg = parser->universalOptions[i];
         ARRAY_PUSH(*new, universalOption, arg);
-        TABLE2_SET(new->options, arg->longName, arg);
+        tableSet(&new->options, (void*)arg->longName, arg);
     }
 
-    TABLE2_SET(parser->modes, name, new);
+    tableSet(&parser->modes, (void*)name, new);
     return new;
 }
 
@@ -582,10 +584,19 @@ posArg* argString(argParser* parser, const char* name) {
     arg.description = name;
     arg.type = POS_STRING;
     arg.helpMessage = "No help message found";
+    arg.repeated = false;
+    ARRAY_ZERO(arg, string);
     ARRAY_PUSH(*parser, posArg, arg);
     return &parser->posArgs[parser->posArgCount - 1];
 }
 
+posArg* argStringList(argParser* parser, const char* name) {
+    posArg* arg = argString(parser, name);
+    arg->repeated = true;
+    ARRAY_ALLOC(char*, *arg, string);
+    return arg;
+}
+
 void argSetHelpMode(argParser* parser, char shortName, const char* longName) {
     parser->helpOption->shortName = shortName;
     parser->helpOption->longName = longName;
@@ -599,9 +610,9 @@ void argSetVersionMode(argParser* parser, char shortName, const char* longName)
 static optionArg* argFindShortName(argParser* parser, char name) {
     // loop through option table to find argument with given short name
     // table is indexed by long name only
-    for(unsigned int i = 0; i < parser->options.entryCapacity; i++) {
-        Entry2* entry = &parser->options.entrys[i];
-        if(entry->key.key == NULL) {
+    for(unsigned int i = 0; i < parser->options.capacity; i++) {
+        Entry* entry = &parser->options.entries[i];
+        if(entry->key.value == NULL) {
             continue;
         }
         optionArg* arg = entry->value;
@@ -639,8 +650,8 @@ static void argParseLongArg(argParser* parser, int* i) {
         name[equals - &parser->argv[*i][2]] = '\0';
 
         // lookup the name of the argument
-        if(TABLE2_HAS(parser->options, name)) {
-            optionArg* value = TABLE2_GET(parser->options, name);
+        optionArg* value;
+        if(tableGet(&parser->options, name, (void**)&value)) {
             switch(value->type) {
                 // only type of option that takes an argument is string
                 case OPT_STRING:
@@ -669,8 +680,8 @@ static void argParseLongArg(argParser* parser, int* i) {
     }
 
     // no argument to the option within this argument
-    if(TABLE2_HAS(parser->options, &parser->argv[*i][2])) {
-        optionArg* value = TABLE2_GET(parser->options, &parser->argv[*i][2]);
+    optionArg* value;
+    if(tableGet(&parser->options, &parser->argv[*i][2], (void**)&value)) {
         switch(value->type) {
             // assume argument after the current one is an argument to the current option
             case OPT_STRING:
@@ -802,8 +813,8 @@ void argParse(argParser* parser) {
     for(int i = 0; i < parser->argc; i++) {
 
         // is the argument one of the possible modes?
-        if(i == 0 && TABLE2_HAS(parser->modes, parser->argv[i])) {
-            argParser* new = TABLE2_GET(parser->modes, parser->argv[i]);
+        argParser* new;
+        if(i == 0 && tableGet(&parser->modes, parser->argv[i], (void**)&new)) {
             // increment arguments, ignoring the mode name
             argArguments(new, parser->argc, parser->argv);
             argParse(new);
@@ -846,14 +857,26 @@ void argParse(argParser* parser) {
             continue;
         }
 
-        // parse positional argument
+        // parse positional argument, a repeated last argument takes every
+        // remaining one
+        posArg* arg = NULL;
         if(parser->currentPosArg < parser->posArgCount) {
-            posArg* arg = &parser->posArgs[parser->currentPosArg];
-            switch(arg->type) {
-                case POS_STRING:
-                    arg->value.as_string = parser->argv[i];
-            }
+            arg = &parser->posArgs[parser->currentPosArg];
             parser->currentPosArg++;
+        } else if(parser->posArgCount > 0 &&
+                  parser->posArgs[parser->posArgCount - 1].repeated) {
+            arg = &parser->posArgs[parser->posArgCount - 1];
+        }
+        if(arg != NULL) {
+            if(arg->repeated) {
+                ARRAY_PUSH(*arg, string, parser->argv[i]);
+            }
+            if(!arg->repeated || arg->stringCount == 1) {
+                switch(arg->type) {
+                    case POS_STRING:
+                        arg->value.as_string = parser->argv[i];
+                }
+            }
             continue;
         }
 
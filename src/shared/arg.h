@@ -1,7 +1,7 @@
 #ifndef ARG_H
 #define ARG_H
 
-#include "shared/table2.h"
+#include "shared/table.h"
 #include "shared/memory.h"
 
 // positional argument
@@ -17,6 +17,11 @@ typedef struct posArg {
 
     const char* description;
     const char* helpMessage;
+
+    // can the argument be given more than once, only for the last positional
+    // argument.  Every value is in strings, value holds the first
+    bool repeated;
+    ARRAY_DEFINE(char*, string);
 } posArg;
 
 typedef struct argParser argParser;
@@ -63,11 +68,11 @@ struct argParser {
 
     // map of all avaliable modes to parsers
     // that can handle the mode
-    Table2 modes;
+    Table modes;
 
     // map of all optional arguments
     // by their long names
-    Table2 options;
+    Table options;
 
     // has the parser run
     bool parsed;
@@ -120,6 +125,10 @@ argParser* argMode(argParser* parser, const char* name);
 // add a string required positional argument to a parser
 posArg* argString(argParser* parser, const char* name);
 
+// add a string positional argument that takes every remaining positional
+// argument, at least one is required.  Must be added last
+posArg* argStringList(argParser* parser, const char* name);
+
 void argSetHelpMode(argParser* parser, char shortName, const char* longName);
 
 // run the parser on the arguments prieviously set
@@ -0,0 +1,117 @@
+#include "shared/buffer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void bufferInit(Buffer* buf) {
+    ARRAY_ALLOC(char, *buf, char);
+    buf->chars[0] = '\0';
+}
+
+void bufferClear(Buffer* buf) {
+    buf->charCount = 0;
+    buf->chars[0] = '\0';
+}
+
+// make sure there is space for extra characters and the null terminator
+static void bufferReserve(Buffer* buf, size_t extra) {
+    size_t required = buf->charCount + extra + 1;
+    if(required <= buf->charCapacity) {
+        return;
+    }
+
+    size_t capacity = buf->charCapacity;
+    while(capacity < required) {
+        capacity *= 2;
+    }
+    buf->chars = ArenaReAlloc(buf->chars, buf->charCapacity, capacity);
+    buf->charCapacity = capacity;
+}
+
+void bufferWrite(Buffer* buf, const char* data, size_t length) {
+    bufferReserve(buf, length);
+    memcpy(buf->chars + buf->charCount, data, length);
+    buf->charCount += length;
+    buf->chars[buf->charCount] = '\0';
+}
+
+void bufferPuts(Buffer* buf, const char* str) {
+    bufferWrite(buf, str, strlen(str));
+}
+
+void bufferPutc(Buffer* buf, char c) {
+    bufferReserve(buf, 1);
+    buf->chars[buf->charCount++] = c;
+    buf->chars[buf->charCount] = '\0';
+}
+
+void bufferPrintf(Buffer* buf, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    bufferVPrintf(buf, format, args);
+    va_end(args);
+}
+
+void bufferVPrintf(Buffer* buf, const char* format, va_list args) {
+    va_list lengthArgs;
+    va_copy(lengthArgs, args);
+    size_t len = vsnprintf(NULL, 0, format, lengthArgs);
+    va_end(lengthArgs);
+
+    bufferReserve(buf, len);
+    vsnprintf(buf->chars + buf->charCount, len + 1, format, args);
+    buf->charCount += len;
+}
+
+void colorBufferInit(ColorBuffer* buf) {
+    bufferInit(&buf->text);
+    buf->colored = false;
+#ifdef _WIN32
+    ARRAY_ALLOC(ColorRun, *buf, run);
+#endif
+}
+
+void colorBufferClear(ColorBuffer* buf) {
+    bufferClear(&buf->text);
+    buf->colored = false;
+#ifdef _WIN32
+    buf->runCount = 0;
+#endif
+}
+
+static void colorBufferSetColor(ColorBuffer* buf, TextColor color) {
+    if(!EnableColor || (buf->colored && buf->color == color)) {
+        return;
+    }
+    buf->color = color;
+    buf->colored = true;
+
+#ifdef _WIN32
+    ColorRun run = {.start = buf->text.charCount, .color = color};
+    ARRAY_PUSH(*buf, run, run);
+#else
+    bufferPrintf(&buf->text, "\x1B[1;%um", color);
+#endif
+}
+
+void colorBufferPutc(ColorBuffer* buf, TextColor color, char c) {
+    // the color of whitespace cannot be seen
+    if(c != ' ' && c != '\n') {
+        colorBufferSetColor(buf, color);
+    }
+    bufferPutc(&buf->text, c);
+}
+
+void colorBufferPrintf(ColorBuffer* buf, TextColor color,
+    const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    colorBufferVPrintf(buf, color, format, args);
+    va_end(args);
+}
+
+void colorBufferVPrintf(ColorBuffer* buf, TextColor color,
+    const char* format, va_list args) {
+    colorBufferSetColor(buf, color);
+    bufferVPrintf(&buf->text, format, args);
+}
@@ -0,0 +1,73 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+#include <stdarg.h>
+#include "shared/memory.h"
+#include "shared/platform.h"
+
+// growable character buffer, used to build output in memory before it is
+// written anywhere.  Always null terminated after the last character.
+typedef struct Buffer {
+    ARRAY_DEFINE(char, char);
+} Buffer;
+
+// initialise an empty buffer
+void bufferInit(Buffer* buf);
+
+// remove all content from the buffer, keeping its memory
+void bufferClear(Buffer* buf);
+
+// append length bytes of data to the buffer
+void bufferWrite(Buffer* buf, const char* data, size_t length);
+
+// append a null terminated string to the buffer
+void bufferPuts(Buffer* buf, const char* str);
+
+// append a single character to the buffer
+void bufferPutc(Buffer* buf, char c);
+
+// append formatted text to the buffer
+void bufferPrintf(Buffer* buf, const char* format, ...);
+void bufferVPrintf(Buffer* buf, const char* format, va_list args);
+
+#ifdef _WIN32
+// where a color starts in a color buffer, as the windows console sets the
+// color with a function call rather than text
+typedef struct ColorRun {
+    size_t start;
+    TextColor color;
+} ColorRun;
+#endif
+
+// text in several colors built in memory so it can be written to the terminal
+// in one go.  The color is only changed where it differs from the text
+// before it
+typedef struct ColorBuffer {
+    Buffer text;
+
+    // color of the last text added, if any text has been added
+    TextColor color;
+    bool colored;
+
+#ifdef _WIN32
+    ARRAY_DEFINE(ColorRun, run);
+#endif
+} ColorBuffer;
+
+// initialise an empty color buffer
+void colorBufferInit(ColorBuffer* buf);
+
+// remove all content from the buffer, keeping its memory
+void colorBufferClear(ColorBuffer* buf);
+
+// append a single character in a color
+void colorBufferPutc(ColorBuffer* buf, TextColor color, char c);
+
+// append formatted text in a color
+void colorBufferPrintf(ColorBuffer* buf, TextColor color,
+    const char* format, ...);
+void colorBufferVPrintf(ColorBuffer* buf, TextColor color,
+    const char* format, va_list args);
+
+#endif
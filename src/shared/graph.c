@@ -2,121 +2,232 @@
 #include "shared/platform.h"
 #include "shared/log.h"
 #include <stdlib.h>
+#include <string.h>
 
 void InitGraph(Graph* graph, NodeDataPrintFn print) {
     CONTEXT(DEBUG, "Creating graph");
+    MEMORY_TAG(MEMORY_GRAPH);
     ARRAY_ALLOC(Node, *graph, node);
     ARRAY_ALLOC(Edge, *graph, edge);
     graph->nodeDataPrint = print;
+    graph->nodeIndex = NULL;
+    graph->nodeIndexCapacity = 0;
+    graph->edgeSet = NULL;
+    graph->edgeSetCapacity = 0;
 }
 
-// is the provided node already in the graph?
-static bool isInArray(Node* arr, unsigned int count, unsigned int value) {
-    for(unsigned int i = 0; i < count; i++) {
-        if(arr[i].value == value) {
-            return true;
-        }
+// get the index of the node with an id, or -1 if it is not in the graph
+static int findNode(Graph* graph, unsigned int id) {
+    if(id >= graph->nodeIndexCapacity) {
+        return -1;
     }
-    return false;
+    return (int)graph->nodeIndex[id] - 1;
 }
 
 Node* AddNode(Graph* graph, unsigned int id, const char* name, void* data) {
+    MEMORY_TAG(MEMORY_GRAPH);
+
+    // search for already existing node and return it
+    int index = findNode(graph, id);
+    if(index >= 0) {
+        return &graph->nodes[index];
+    }
+
+    // grow the lookup table to fit the new id
+    if(id >= graph->nodeIndexCapacity) {
+        unsigned int capacity = graph->nodeIndexCapacity == 0 ? 64 :
+            graph->nodeIndexCapacity;
+        while(capacity <= id) {
+            capacity *= 2;
+        }
+        graph->nodeIndex = ArenaReAlloc(graph->nodeIndex,
+            sizeof(unsigned int) * graph->nodeIndexCapacity,
+            sizeof(unsigned int) * capacity);
+        memset(graph->nodeIndex + graph->nodeIndexCapacity, 0,
+            sizeof(unsigned int) * (capacity - graph->nodeIndexCapacity));
+        graph->nodeIndexCapacity = capacity;
+    }
+
+    // add new node
     Node newNode = {
         .value = id,
         .removed = false,
         .name = name,
         .data = data
     };
+    ARRAY_PUSH(*graph, node, newNode);
+    graph->nodeIndex[id] = graph->nodeCount;
+    return &graph->nodes[graph->nodeCount - 1];
+}
 
-    // add new node
-    if(!isInArray(graph->nodes, graph->nodeCount, id)) {
-        ARRAY_PUSH(*graph, node, newNode);
-        return &graph->nodes[graph->nodeCount - 1];
+static unsigned int edgeHash(uint64_t key, unsigned int capacity) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key & (capacity - 1);
+}
+
+// add an edge to the set of edges, returns false if it was already present.
+// Keys are stored + 1 so 0 can mark an empty slot
+static bool edgeSetAdd(Graph* graph, uint64_t key) {
+    key += 1;
+
+    // keep the set at most half full
+    if((graph->edgeCount + 1) * 2 > graph->edgeSetCapacity) {
+        unsigned int capacity = graph->edgeSetCapacity == 0 ? 64 :
+            graph->edgeSetCapacity * 2;
+        uint64_t* set = ArenaAlloc(sizeof(uint64_t) * capacity);
+        memset(set, 0, sizeof(uint64_t) * capacity);
+        for(unsigned int i = 0; i < graph->edgeSetCapacity; i++) {
+            uint64_t old = graph->edgeSet[i];
+            if(old == 0) continue;
+            unsigned int slot = edgeHash(old, capacity);
+            while(set[slot] != 0) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            set[slot] = old;
+        }
+        graph->edgeSet = set;
+        graph->edgeSetCapacity = capacity;
     }
 
-    // search for already existing node and return it
-    for(unsigned int i = 0; i < graph->nodeCount; i++) {
-        if(graph->nodes[i].value == id) {
-            return &graph->nodes[i];
+    unsigned int slot = edgeHash(key, graph->edgeSetCapacity);
+    while(graph->edgeSet[slot] != 0) {
+        if(graph->edgeSet[slot] == key) {
+            return false;
         }
+        slot = (slot + 1) & (graph->edgeSetCapacity - 1);
     }
-    return NULL;
+    graph->edgeSet[slot] = key;
+    return true;
 }
 
 void AddEdge(Graph* graph, Node* start, Node* end) {
     CONTEXT(TRACE, "Graph edge add");
-    for(unsigned int i = 0; i < graph->edgeCount; i++) {
-        if(graph->edges[i].start == start &&
-           graph->edges[i].end == end) {
-            return;
-        }
-    }
+    MEMORY_TAG(MEMORY_GRAPH);
 
+    // looked up by id as the pointers may be from before the node array was
+    // last re-allocated
     Edge e = {
-        .start = start,
-        .end = end,
+        .start = findNode(graph, start->value),
+        .end = findNode(graph, end->value),
     };
+
+    if(!edgeSetAdd(graph, ((uint64_t)e.start << 32) | e.end)) {
+        return;
+    }
     ARRAY_PUSH(*graph, edge, e);
 }
 
 NodeArray NodesNoInput(Graph* graph) {
     CONTEXT(TRACE, "graph NodesNoInput");
+    MEMORY_TAG(MEMORY_GRAPH);
 
     // initialise return value
     NodeArray ret;
     ARRAY_ALLOC(Node*, ret, node);
 
-    // check each node
+    // count active edges into each active node
+    unsigned int* inDegree = ArenaAlloc(sizeof(unsigned int) * (graph->nodeCount + 1));
+    memset(inDegree, 0, sizeof(unsigned int) * graph->nodeCount);
+    for(unsigned int i = 0; i < graph->edgeCount; i++) {
+        Edge* e = &graph->edges[i];
+        if(!graph->nodes[e->start].removed && !graph->nodes[e->end].removed) {
+            inDegree[e->end]++;
+        }
+    }
+
     for(unsigned int i = 0; i < graph->nodeCount; i++) {
         Node* node = &graph->nodes[i];
-        if(node->removed) {
-            continue;
+        if(!node->removed && inDegree[i] == 0) {
+            ARRAY_PUSH(ret, node, node);
         }
+    }
+    return ret;
+}
 
-        bool incoming = false;
-
-        // check each edge
-        for(unsigned int j = 0; j < graph->edgeCount; j++) {
-            Edge* e = &graph->edges[j];
+// min-heap of node indexes, so the earliest added node is always taken next
+static void heapPush(unsigned int* heap, unsigned int* count, unsigned int value) {
+    unsigned int i = (*count)++;
+    while(i > 0 && heap[(i - 1) / 2] > value) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = value;
+}
 
-            // if both ends still should be checked and ends on current node
-            if(!e->start->removed && !e->end->removed && e->end->value == node->value) {
-                incoming = true;
-            }
-        }
-        if(!incoming) {
-            ARRAY_PUSH(ret, node, node);
+static unsigned int heapPop(unsigned int* heap, unsigned int* count) {
+    unsigned int top = heap[0];
+    unsigned int value = heap[--(*count)];
+    unsigned int i = 0;
+    while(true) {
+        unsigned int child = i * 2 + 1;
+        if(child >= *count) break;
+        if(child + 1 < *count && heap[child + 1] < heap[child]) {
+            child++;
         }
+        if(heap[child] >= value) break;
+        heap[i] = heap[child];
+        i = child;
     }
-    return ret;
+    heap[i] = value;
+    return top;
 }
 
 NodeArray TopologicalSort(Graph* graph) {
     CONTEXT(TRACE, "Toposort");
+    MEMORY_TAG(MEMORY_GRAPH);
 
     NodeArray ret;
     ARRAY_ALLOC(Node*, ret, node);
 
-    // toposort
-    NodeArray s = NodesNoInput(graph);
-    while(s.nodeCount > 0) {
-        Node* node = s.nodes[0];
-        ARRAY_PUSH(ret, node, node);
-        node->removed = true;
-        s = NodesNoInput(graph);
+    unsigned int nodeCount = graph->nodeCount;
+
+    // compressed adjacency lists, the edges out of node i are
+    // targets[offsets[i]] to targets[offsets[i+1]]
+    unsigned int* offsets = ArenaAlloc(sizeof(unsigned int) * (nodeCount + 1));
+    unsigned int* inDegree = ArenaAlloc(sizeof(unsigned int) * (nodeCount + 1));
+    memset(offsets, 0, sizeof(unsigned int) * (nodeCount + 1));
+    memset(inDegree, 0, sizeof(unsigned int) * nodeCount);
+    for(unsigned int i = 0; i < graph->edgeCount; i++) {
+        offsets[graph->edges[i].start + 1]++;
+        inDegree[graph->edges[i].end]++;
+    }
+    for(unsigned int i = 0; i < nodeCount; i++) {
+        offsets[i + 1] += offsets[i];
     }
 
-    // re-activate all nodes and check if any nodes were not picked
-    bool retNull = false;
-    for(unsigned int i = 0; i < graph->nodeCount; i++) {
-        if(!graph->nodes[i].removed) {
-            retNull = true;
-        } else {
-            graph->nodes[i].removed = false;
+    unsigned int* targets = ArenaAlloc(sizeof(unsigned int) *
+        (graph->edgeCount + 1));
+    unsigned int* fill = ArenaAlloc(sizeof(unsigned int) * (nodeCount + 1));
+    memcpy(fill, offsets, sizeof(unsigned int) * nodeCount);
+    for(unsigned int i = 0; i < graph->edgeCount; i++) {
+        targets[fill[graph->edges[i].start]++] = graph->edges[i].end;
+    }
+
+    // kahn's algorithm, taking nodes with no remaining inputs
+    unsigned int* ready = ArenaAlloc(sizeof(unsigned int) * (nodeCount + 1));
+    unsigned int readyCount = 0;
+    for(unsigned int i = 0; i < nodeCount; i++) {
+        if(inDegree[i] == 0) {
+            heapPush(ready, &readyCount, i);
+        }
+    }
+
+    while(readyCount > 0) {
+        unsigned int node = heapPop(ready, &readyCount);
+        Node* nodePtr = &graph->nodes[node];
+        ARRAY_PUSH(ret, node, nodePtr);
+
+        for(unsigned int i = offsets[node]; i < offsets[node + 1]; i++) {
+            if(--inDegree[targets[i]] == 0) {
+                heapPush(ready, &readyCount, targets[i]);
+            }
         }
     }
 
-    ret.validArray = !retNull;
+    // any node not picked is part of a cycle
+    ret.validArray = ret.nodeCount == nodeCount;
     return ret;
 }
 
@@ -130,11 +241,12 @@ void printGraph(Graph* graph, graphPrintFn printFn) {
     }
 
     for(unsigned int i = 0; i < graph->edgeCount; i++) {
-        Edge* edge = &graph->edges[i];
-        printFn(TextWhite, "\t\"%s (", edge->start->name);
-        graph->nodeDataPrint(edge->start->data, printFn);
-        printFn(TextWhite, ")\" -> \"%s (", edge->end->name);
-        graph->nodeDataPrint(edge->end->data, printFn);
+        Node* start = &graph->nodes[graph->edges[i].start];
+        Node* end = &graph->nodes[graph->edges[i].end];
+        printFn(TextWhite, "\t\"%s (", start->name);
+        graph->nodeDataPrint(start->data, printFn);
+        printFn(TextWhite, ")\" -> \"%s (", end->name);
+        graph->nodeDataPrint(end->data, printFn);
         printFn(TextWhite, ")\";\n");
     }
     printFn(TextWhite, "}\n");
@@ -1,12 +1,14 @@
 #ifndef GRAPH_H
 #define GRAPH_H
 
+#include <stdint.h>
 #include "shared/memory.h"
 #include "shared/platform.h"
 
 typedef struct Node {
     // unique id, can be any number user provided
-    // ids do not have to be sequential
+    // ids do not have to be sequential, but are used to index a lookup table
+    // so should be small
     unsigned int value;
 
     // name of the node, only used in printing the graph
@@ -16,14 +18,14 @@ typedef struct Node {
     // user-definable data for the node
     void* data;
 
-    // is the node still active, used in toposport
+    // is the node still active, used by NodesNoInput
     bool removed;
 } Node;
 
-// link between two nodes
+// link between two nodes, stored as indexes into the graph's node array
 typedef struct Edge {
-    Node* start;
-    Node* end;
+    unsigned int start;
+    unsigned int end;
 } Edge;
 
 
@@ -36,6 +38,15 @@ typedef struct Graph {
     ARRAY_DEFINE(Node, node);
     ARRAY_DEFINE(Edge, edge);
     NodeDataPrintFn nodeDataPrint;
+
+    // index into the node array + 1 for each node id, 0 if there is no node
+    // with that id.  Node ids are expected to be small.
+    unsigned int* nodeIndex;
+    unsigned int nodeIndexCapacity;
+
+    // open addressed set of edges already added, for finding duplicates
+    uint64_t* edgeSet;
+    unsigned int edgeSetCapacity;
 } Graph;
 
 // temporary array result
@@ -55,13 +66,15 @@ void InitGraph(Graph* graph, NodeDataPrintFn nodeDataPrint);
 // the one it already had, not what was passed to this function.
 Node* AddNode(Graph* graph, unsigned int id, const char* name, void* data);
 
-// adds an edge between two already added nodes
+// adds an edge between two already added nodes, nodes are matched by id so
+// any pointer returned by AddNode for the node can be used
 void AddEdge(Graph* graph, Node* start, Node* end);
 
 // return the array of active nodes with no edges directed inwards
 NodeArray NodesNoInput(Graph* graph);
 
-// sort the nodes
+// sort the nodes, when several nodes could be next the one added to the graph
+// first is picked.  The result is not valid if the graph has a cycle
 NodeArray TopologicalSort(Graph* graph);
 
 void printGraph(Graph* graph, graphPrintFn printFn);
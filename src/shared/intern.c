@@ -0,0 +1,71 @@
+#include "shared/intern.h"
+
+#include <string.h>
+#include <pthread.h>
+#include "shared/memory.h"
+#include "shared/table.h"
+
+// key in the intern table, chars is the atom once stored
+typedef struct InternKey {
+    const char* chars;
+    size_t length;
+} InternKey;
+
+static Table strings;
+static bool stringsInitialized = false;
+static pthread_mutex_t stringsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t internHash(void* value) {
+    InternKey* key = value;
+    return (uint32_t)hashBytes(key->chars, key->length);
+}
+
+static bool internCmp(void* a, void* b) {
+    InternKey* keyA = a;
+    InternKey* keyB = b;
+    return keyA->length == keyB->length &&
+        memcmp(keyA->chars, keyB->chars, keyA->length) == 0;
+}
+
+const char* internString(const char* str, size_t length) {
+    InternKey search = {
+        .chars = str,
+        .length = length
+    };
+
+    pthread_mutex_lock(&stringsLock);
+    if(!stringsInitialized) {
+        initTable(&strings, internHash, internCmp);
+        stringsInitialized = true;
+    }
+
+    InternKey* key;
+    if(!tableGetKey(&strings, &search, (void**)&key)) {
+        // atoms outlive any scope they are first seen in
+        ARENA_PERSISTENT();
+        char* chars = ArenaAlloc(length + 1);
+        memcpy(chars, str, length);
+        chars[length] = '\0';
+
+        key = ArenaAlloc(sizeof(InternKey));
+        key->chars = chars;
+        key->length = length;
+        tableSet(&strings, key, NULL);
+    }
+    pthread_mutex_unlock(&stringsLock);
+
+    return key->chars;
+}
+
+const char* intern(const char* str) {
+    return internString(str, strlen(str));
+}
+
+uint32_t atomHash(void* value) {
+    uintptr_t ptr = (uintptr_t)value;
+    return (uint32_t)(ptr ^ ((uint64_t)ptr >> 32));
+}
+
+bool atomCmp(void* a, void* b) {
+    return a == b;
+}
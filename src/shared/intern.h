@@ -0,0 +1,25 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// String interning, every distinct string is stored once and equal strings
+// map to the same pointer (an atom).  Atoms are null terminated, live for
+// the rest of the program and can be compared with ==.  Safe to call from
+// any thread.
+
+// get the atom for length bytes of str, str does not have to be terminated
+const char* internString(const char* str, size_t length);
+
+// get the atom for a null terminated string
+const char* intern(const char* str);
+
+// hash function for atom keys, hashes the pointer not the characters
+uint32_t atomHash(void* value);
+
+// key comparison function for atom keys
+bool atomCmp(void* a, void* b);
+
+#endif
@@ -4,67 +4,324 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
 #include "shared/platform.h"
 
-FILE* logFile = NULL;
-
 // TODO: Add log tags based on fmt hash
 // TODO: Add tag based filtering
 // TODO: Add logging to the rest of the program
-// TODO: Don't write to file until file provided so messages can be filtered
-//       if emitted before minimum log level set.
 
-bool logInit() {
-    logFile = tmpfile();
-    if(logFile == NULL) {
-        puts("Error creating temporary file in log initialisation.\n");
-        return false;
+// Every thread formats its messages into its own ring buffer, which only it
+// writes to, so logging never waits on another thread.  A background thread
+// drains the buffers into the log file.  A thread drains the buffers itself
+// if its buffer is full.  Logging uses malloc as the arena logs its own
+// allocations.
+
+#define LOG_BUFFER_SIZE (64 * 1024)
+
+// how long the background thread waits between draining the buffers
+#define LOG_DRAIN_INTERVAL_NS (20 * 1000 * 1000)
+
+typedef struct LogBuffer LogBuffer;
+struct LogBuffer {
+    LogBuffer* next;
+    unsigned int thread;
+
+    // written by the owning thread up to head, read by the drain up to tail
+    char data[LOG_BUFFER_SIZE];
+    atomic_size_t head;
+    atomic_size_t tail;
+};
+
+// buffers are added to the front of the list and never removed, so the drain
+// can walk the list without holding a lock
+static _Atomic(LogBuffer*) logBuffers = NULL;
+static atomic_uint logThreadCount = 0;
+static _Thread_local LogBuffer* logBuffer = NULL;
+
+// message being formatted, before it is copied into the buffer
+static _Thread_local char* logMessage = NULL;
+static _Thread_local size_t logMessageLength = 0;
+static _Thread_local size_t logMessageCapacity = 0;
+
+// where drained messages go.  Until a file is chosen they are kept in memory
+// so they can still be written once it is
+static pthread_mutex_t drainLock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* logFile = NULL;
+static bool logFileChosen = false;
+static char* logPending = NULL;
+static size_t logPendingLength = 0;
+static size_t logPendingCapacity = 0;
+static unsigned int logLastThread = 0;
+
+static pthread_t drainThread;
+static bool drainRunning = false;
+static bool drainStop = false;
+static pthread_mutex_t drainWakeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drainWake = PTHREAD_COND_INITIALIZER;
+
+static int minumumLevel = 0;
+int _log_minimum_level_ = 0;
+
+static atomic_int errorWarnCount = 0;
+
+static void growTo(char** data, size_t* capacity, size_t size) {
+    if(size <= *capacity) {
+        return;
+    }
+    size_t newCapacity = *capacity == 0 ? 256 : *capacity;
+    while(newCapacity < size) {
+        newCapacity *= 2;
+    }
+    char* newData = realloc(*data, newCapacity);
+    if(newData == NULL) {
+        abort();
+    }
+    *data = newData;
+    *capacity = newCapacity;
+}
+
+// output drained text, drainLock must be held
+static void logOutput(const char* data, size_t length) {
+    if(logFile != NULL) {
+        fwrite(data, 1, length, logFile);
+    } else if(!logFileChosen) {
+        growTo(&logPending, &logPendingCapacity, logPendingLength + length);
+        memcpy(logPending + logPendingLength, data, length);
+        logPendingLength += length;
+    }
+}
+
+// output everything a thread has logged, marking where the messages switch
+// between threads as each thread's contexts are written relative to its own
+// earlier messages.  drainLock must be held
+static void drainBuffer(LogBuffer* buffer) {
+    size_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+    if(head == tail) {
+        return;
+    }
+
+    if(buffer->thread != logLastThread) {
+        char marker[32];
+        int length = snprintf(marker, sizeof(marker), "[thread %u]\n",
+            buffer->thread);
+        logOutput(marker, length);
+        logLastThread = buffer->thread;
+    }
+
+    size_t start = tail % LOG_BUFFER_SIZE;
+    size_t length = head - tail;
+    if(start + length > LOG_BUFFER_SIZE) {
+        size_t first = LOG_BUFFER_SIZE - start;
+        logOutput(buffer->data + start, first);
+        logOutput(buffer->data, length - first);
+    } else {
+        logOutput(buffer->data + start, length);
+    }
+
+    atomic_store_explicit(&buffer->tail, head, memory_order_release);
+}
+
+static void drainAll() {
+    pthread_mutex_lock(&drainLock);
+    for(LogBuffer* buffer = atomic_load(&logBuffers); buffer != NULL;
+        buffer = buffer->next) {
+        drainBuffer(buffer);
+    }
+    if(logFile != NULL) {
+        fflush(logFile);
+    }
+    pthread_mutex_unlock(&drainLock);
+}
+
+static void* drainLoop(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&drainWakeLock);
+    while(!drainStop) {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += LOG_DRAIN_INTERVAL_NS;
+        if(wake.tv_nsec >= 1000000000) {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&drainWake, &drainWakeLock, &wake);
+
+        pthread_mutex_unlock(&drainWakeLock);
+        drainAll();
+        pthread_mutex_lock(&drainWakeLock);
+    }
+    pthread_mutex_unlock(&drainWakeLock);
+
+    return NULL;
+}
+
+static LogBuffer* threadBuffer() {
+    if(logBuffer == NULL) {
+        LogBuffer* buffer = malloc(sizeof(LogBuffer));
+        if(buffer == NULL) {
+            abort();
+        }
+        atomic_init(&buffer->head, 0);
+        atomic_init(&buffer->tail, 0);
+        buffer->thread = atomic_fetch_add(&logThreadCount, 1);
+
+        buffer->next = atomic_load(&logBuffers);
+        while(!atomic_compare_exchange_weak(&logBuffers, &buffer->next,
+            buffer));
+        logBuffer = buffer;
+    }
+    return logBuffer;
+}
+
+// copy the formatted message into this thread's buffer
+static void logCommit() {
+    LogBuffer* buffer = threadBuffer();
+    const char* data = logMessage;
+    size_t length = logMessageLength;
+
+    // too large to ever fit, write it out directly after anything queued
+    if(length > LOG_BUFFER_SIZE) {
+        pthread_mutex_lock(&drainLock);
+        drainBuffer(buffer);
+        logOutput(data, length);
+        pthread_mutex_unlock(&drainLock);
+        return;
+    }
+
+    size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+    if(LOG_BUFFER_SIZE - (head - tail) < length) {
+        drainAll();
+    }
+
+    size_t start = head % LOG_BUFFER_SIZE;
+    if(start + length > LOG_BUFFER_SIZE) {
+        size_t first = LOG_BUFFER_SIZE - start;
+        memcpy(buffer->data + start, data, first);
+        memcpy(buffer->data, data + first, length - first);
+    } else {
+        memcpy(buffer->data + start, data, length);
+    }
+
+    atomic_store_explicit(&buffer->head, head + length, memory_order_release);
+}
+
+static void messageAppendV(const char* fmt, va_list args) {
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+
+    size_t space = logMessageCapacity - logMessageLength;
+    int length = vsnprintf(logMessage + logMessageLength, space, fmt, args);
+    if(length >= 0 && (size_t)length >= space) {
+        growTo(&logMessage, &logMessageCapacity,
+            logMessageLength + length + 1);
+        vsnprintf(logMessage + logMessageLength, length + 1, fmt, argsCopy);
     }
+    if(length > 0) {
+        logMessageLength += length;
+    }
+
+    va_end(argsCopy);
+}
+
+static void messageAppend(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    messageAppendV(fmt, args);
+    va_end(args);
+}
+
+// only warnings and errors are counted once the log is discarded
+static void updateMinimumLevel() {
+    _log_minimum_level_ = minumumLevel;
+    if(logFileChosen && logFile == NULL && _log_minimum_level_ < 600) {
+        _log_minimum_level_ = 600;
+    }
+}
+
+bool logInit() {
+    threadBuffer();
     return true;
 }
 
-static int errorWarnCount = 0;
+void logFlush() {
+    drainAll();
+}
+
 void logClose() {
+    if(drainRunning) {
+        pthread_mutex_lock(&drainWakeLock);
+        drainStop = true;
+        pthread_cond_signal(&drainWake);
+        pthread_mutex_unlock(&drainWakeLock);
+        pthread_join(drainThread, NULL);
+        drainRunning = false;
+    }
+
+    drainAll();
+
+    pthread_mutex_lock(&drainLock);
     if(logFile != NULL) {
         fclose(logFile);
+        logFile = NULL;
     }
+    logFileChosen = true;
+    free(logPending);
+    logPending = NULL;
+    logPendingLength = 0;
+    logPendingCapacity = 0;
+    pthread_mutex_unlock(&drainLock);
+    updateMinimumLevel();
+
 #ifdef DEBUG_BUILD
-    if(errorWarnCount > 0) {
+    int count = atomic_load(&errorWarnCount);
+    if(count > 0) {
         cErrPrintf(TextRed, "Encountered %u logged internal errors or "
-            "warnings\n", errorWarnCount);
+            "warnings\n", count);
     }
 #endif
 }
 
-void fileCopy(FILE* a, FILE* b) {
-    char c;
-    while((c = fgetc(a)) != EOF) {
-        fputc(c, b);
-    }
-}
-
 bool logSetFile(FILE* file) {
-    if(logFile != NULL) {
-        fileCopy(logFile, file);
-        fclose(logFile);
+    drainAll();
+
+    pthread_mutex_lock(&drainLock);
+    logFile = file;
+    logFileChosen = true;
+    if(file != NULL) {
+        fwrite(logPending, 1, logPendingLength, file);
     }
-    if(file == NULL) {
-        puts("Specified log file does not exist.\n");
-        return false;
+    free(logPending);
+    logPending = NULL;
+    logPendingLength = 0;
+    logPendingCapacity = 0;
+    pthread_mutex_unlock(&drainLock);
+    updateMinimumLevel();
+
+    if(file != NULL && !drainRunning) {
+        drainStop = false;
+        drainRunning = pthread_create(&drainThread, NULL, drainLoop, NULL) == 0;
     }
-    logFile = file;
     return true;
 }
 
 static LogContext firstContext = {
     .filename = "no context"
 };
-LogContext* _log_current_context_ = &firstContext;
-int _log_current_context_depth_ = 0;
-static LogContext* logWrittenContext = NULL;
-static int logDepth = 0;
+_Thread_local LogContext* _log_current_context_ = &firstContext;
+_Thread_local int _log_current_context_depth_ = 0;
+static _Thread_local LogContext* logWrittenContext = NULL;
+static _Thread_local int logDepth = 0;
 
 void logContextEnd(LogContext* ctx){
+    if(ctx->timed) {
+        profileContextEnd(ctx);
+    }
     _log_current_context_ = ctx->next;
     if(logWrittenContext == ctx) {
         logWrittenContext = ctx->next;
@@ -73,63 +330,75 @@ void logContextEnd(LogContext* ctx){
     _log_current_context_depth_ -= 1;
 }
 
-static int minumumLevel = 0;
 void logSetMinLevel(int level) {
     minumumLevel = level;
+    updateMinimumLevel();
 }
 
 void logLog(int level, int line, const char* file, const char* fmt, ...) {
-    if(level < minumumLevel || fmt[0] == '\0') {
-        return;
+    if(level >= 600) {
+        atomic_fetch_add(&errorWarnCount, 1);
     }
 
-    if(level >= 600) {
-        errorWarnCount++;
+    if(level < _log_minimum_level_ || fmt[0] == '\0' ||
+       (logFileChosen && logFile == NULL)) {
+        return;
     }
 
     va_list args;
     va_start(args, fmt);
 
+    logMessageLength = 0;
+    growTo(&logMessage, &logMessageCapacity, 256);
+
     if(logWrittenContext != _log_current_context_) {
         int unprintedCount = _log_current_context_depth_ - logDepth;
-        LogContext* ctxs[unprintedCount];
-        ctxs[0] = _log_current_context_;
-        for(int i = 1; i < unprintedCount; i++) {
-            ctxs[i] = ctxs[i-1]->next;
-        }
-        for(int i = unprintedCount - 1; i >= 0; i--) {
-            LogContext* ctx = ctxs[i];
-            fprintf(logFile, "%*s%s:%s at %s: \n", logDepth * 2, "", ctx->filename, ctx->line, ctx->function);
-            logDepth += 1;
+        if(unprintedCount > 0) {
+            LogContext* ctxs[unprintedCount];
+            ctxs[0] = _log_current_context_;
+            for(int i = 1; i < unprintedCount; i++) {
+                ctxs[i] = ctxs[i-1]->next;
+            }
+            for(int i = unprintedCount - 1; i >= 0; i--) {
+                LogContext* ctx = ctxs[i];
+                messageAppend("%*s%s:%s at %s: \n", logDepth * 2, "",
+                    ctx->filename, ctx->line, ctx->function);
+                logDepth += 1;
+            }
         }
         logWrittenContext = _log_current_context_;
     }
 
-    fprintf(logFile, "%*s", logDepth * 2, "");
+    messageAppend("%*s", logDepth * 2, "");
     if(strcmp(_log_current_context_->filename, file) == 0) {
-        fprintf(logFile, "&");
+        messageAppend("&");
     } else {
-        fprintf(logFile, "%s", file);
+        messageAppend("%s", file);
     }
-    fprintf(logFile, ":%i ", line);
+    messageAppend(":%i ", line);
     if(level >= 1000) {
-        fputs("FATAL", logFile);
+        messageAppend("FATAL");
     } else if(level >= 800) {
-        fputs("ERROR", logFile);
+        messageAppend("ERROR");
     } else if(level >= 600) {
-        fputs("WARN", logFile);
+        messageAppend("WARN");
     } else if(level >= 400) {
-        fputs("INFO", logFile);
+        messageAppend("INFO");
     } else if(level >= 200) {
-        fputs("DEBUG", logFile);
+        messageAppend("DEBUG");
     } else {
-        fputs("TRACE", logFile);
+        messageAppend("TRACE");
     }
-    fprintf(logFile, "(%u) ", level);
-    vfprintf(logFile, fmt, args);
-    fprintf(logFile, "\n");
-
-    fflush(logFile);
+    messageAppend("(%u) ", level);
+    messageAppendV(fmt, args);
+    messageAppend("\n");
 
     va_end(args);
-}
\ No newline at end of file
+
+    logCommit();
+
+    // the program is likely about to stop, make sure the message is written
+    if(level >= 1000) {
+        logFlush();
+    }
+}
@@ -14,36 +14,80 @@ struct LogContext {
     const char* filename;
     const char* line;
     const char* function;
+
+    // when profiling, the time the context was entered and the time spent in
+    // the contexts nested directly inside it
+    bool timed;
+    double start;
+    double childTime;
 };
 
-extern LogContext* _log_current_context_;
-extern int _log_current_context_depth_;
+// each thread has its own chain of contexts
+extern _Thread_local LogContext* _log_current_context_;
+extern _Thread_local int _log_current_context_depth_;
+
+// lowest level that is formatted and written, messages below it cost a
+// comparison
+extern int _log_minimum_level_;
 
-#define CONTEXT(logger, ...) \
+// set while profiling, defined in profile.c
+extern bool _profile_enabled_;
+void profileContextBegin(LogContext* ctx);
+void profileContextEnd(LogContext* ctx);
+
+#define _CONTEXT_PUSH_ \
     LogContext _log_context_ __attribute__((cleanup(logContextEnd))) \
     = {_log_current_context_, __FILE__ + SOURCE_PATH_SIZE, \
         STRINGIFY(__LINE__), __func__}; \
     _log_current_context_depth_ += 1; \
-    _log_current_context_ = &_log_context_;\
-    logger(__VA_ARGS__)
+    _log_current_context_ = &_log_context_; \
+    if(_profile_enabled_) { \
+        profileContextBegin(&_log_context_); \
+    }
+
+// contexts for levels that are compiled out are removed completely
+#define CONTEXT(logger, ...) _CONTEXT_##logger(__VA_ARGS__)
 
 #ifdef DEBUG_BUILD
-    #define TRACE(...) logLog(0, __LINE__, __FILE__ + SOURCE_PATH_SIZE, ##__VA_ARGS__)
-    #define DEBUG(...) logLog(200, __LINE__, __FILE__ + SOURCE_PATH_SIZE, ##__VA_ARGS__)
+    #define TRACE(...) LOG(0, ##__VA_ARGS__)
+    #define DEBUG(...) LOG(200, ##__VA_ARGS__)
+    #define _CONTEXT_TRACE(...) _CONTEXT_PUSH_; TRACE(__VA_ARGS__)
+    #define _CONTEXT_DEBUG(...) _CONTEXT_PUSH_; DEBUG(__VA_ARGS__)
 #else
     #define TRACE(...)
     #define DEBUG(...)
+    #define _CONTEXT_TRACE(...)
+    #define _CONTEXT_DEBUG(...)
 #endif
-#define INFO(...) logLog(400, __LINE__, __FILE__ + SOURCE_PATH_SIZE, ##__VA_ARGS__)
-#define WARN(...) logLog(600, __LINE__, __FILE__ + SOURCE_PATH_SIZE, ##__VA_ARGS__)
-#define ERROR(...) logLog(800, __LINE__, __FILE__ + SOURCE_PATH_SIZE, ##__VA_ARGS__)
-#define FATAL(...) logLog(1000, __LINE__, __FILE__ + SOURCE_PATH_SIZE, ##__VA_ARGS__)
-#define LOG(level, ...) logLog(level, __LINE__, __FILE__ + SOURCE_PATH_SIZE, ##__VA_ARGS__)
+#define INFO(...) LOG(400, ##__VA_ARGS__)
+#define WARN(...) LOG(600, ##__VA_ARGS__)
+#define ERROR(...) LOG(800, ##__VA_ARGS__)
+#define FATAL(...) LOG(1000, ##__VA_ARGS__)
+#define LOG(level, ...) do { \
+        if((level) >= _log_minimum_level_) { \
+            logLog(level, __LINE__, __FILE__ + SOURCE_PATH_SIZE, ##__VA_ARGS__); \
+        } \
+    } while(0)
 
+#define _CONTEXT_INFO(...) _CONTEXT_PUSH_; INFO(__VA_ARGS__)
+#define _CONTEXT_WARN(...) _CONTEXT_PUSH_; WARN(__VA_ARGS__)
+#define _CONTEXT_ERROR(...) _CONTEXT_PUSH_; ERROR(__VA_ARGS__)
+#define _CONTEXT_FATAL(...) _CONTEXT_PUSH_; FATAL(__VA_ARGS__)
+
+// messages are held in memory until logSetFile chooses where they go
 bool logInit();
+
+// write out every message logged so far and close the log file
 void logClose();
+
+// write the log to a file, messages are buffered per thread and written by a
+// background thread.  A NULL file discards the log, after which only
+// warnings and errors are counted
 bool logSetFile(FILE* file);
 
+// write every message logged so far to the log file
+void logFlush();
+
 void logContextEnd(LogContext* ctx);
 void logLog(int level, int line, const char* file, const char* fmt, ...);
 
@@ -2,13 +2,93 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 #include "shared/memory.h"
+#include "shared/platform.h"
 
-// global instance of arena,
-// only place memory is stored in the program
-// is not freed, assumes enough memory for all
-// alocations to exist
-static Arena arena;
+// each thread has a long lived arena and two scratch arenas used for
+// temporary scopes, so allocation never has to wait on another thread.
+// Long lived memory is not freed, other than large blocks that are
+// re-allocated, assumes enough memory for all alocations to exist.
+// As it is never freed, a pointer allocated by one thread stays valid after
+// the thread finishes and can be handed to any other thread.
+static _Thread_local Arena persistentArena;
+static _Thread_local Arena scratchArenas[2];
+
+// the arena allocations currently come from
+static _Thread_local Arena* arena = NULL;
+
+// memory use of every thread, each thread only updates its own counters so
+// allocation does not need any synchronisation.  Adding chunks and large
+// blocks is rare, so the totals of those are shared
+typedef struct ThreadMemoryStats {
+    MemoryTagStats tags[MEMORY_TAG_COUNT];
+
+    // bytes requested with any tag, can be read while the thread is running
+    atomic_size_t requested;
+
+    struct ThreadMemoryStats* next;
+} ThreadMemoryStats;
+
+static _Thread_local ThreadMemoryStats threadStats;
+static _Thread_local MemoryTag currentTag = MEMORY_OTHER;
+
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadMemoryStats* allStats = NULL;
+
+static atomic_size_t chunkCount;
+static atomic_size_t largeCount;
+static atomic_size_t reservedBytes;
+static atomic_size_t peakReservedBytes;
+
+static const char* memoryTagNames[MEMORY_TAG_COUNT] = {
+    [MEMORY_OTHER] = "other",
+    [MEMORY_AST] = "scanner/ast",
+    [MEMORY_ANALYSIS] = "analysis",
+    [MEMORY_GRAPH] = "graph",
+    [MEMORY_CODEGEN] = "codegen",
+    [MEMORY_ERROR] = "diagnostics"
+};
+
+// record memory taken from or returned to the system
+static void statsReserve(size_t bytes) {
+    size_t reserved = atomic_fetch_add(&reservedBytes, bytes) + bytes;
+    size_t peak = atomic_load(&peakReservedBytes);
+    while(reserved > peak &&
+        !atomic_compare_exchange_weak(&peakReservedBytes, &peak, reserved));
+}
+
+static void statsRelease(size_t bytes) {
+    atomic_fetch_sub(&reservedBytes, bytes);
+}
+
+// only the owning thread writes its total, so it does not need to be locked
+static void statsRequest(size_t bytes) {
+    threadStats.tags[currentTag].allocations++;
+    threadStats.tags[currentTag].requested += bytes;
+    atomic_store_explicit(&threadStats.requested, atomic_load_explicit(
+        &threadStats.requested, memory_order_relaxed) + bytes,
+        memory_order_relaxed);
+}
+
+#define ARENA_FIRST_CHUNK (4096 * 16)
+#define ARENA_MAX_CHUNK (4096 * 4096)
+
+// header stored before a large block
+typedef struct ArenaLarge {
+    // large block allocated before this one in the same arena
+    struct ArenaLarge* next;
+    Arena* owner;
+    size_t serial;
+
+    // size of the mapping and the offset of the block from its start
+    size_t mapSize;
+    size_t offset;
+} ArenaLarge;
 
 // increments pointer until it is aligned to align
 // align (bytes) must be a power of 2
@@ -23,88 +103,325 @@ static int AlignForward(void* real_ptr, size_t align) {
     return modulo==0?0:align_ptr - modulo;
 }
 
+// add a chunk that can hold at least size bytes at the given alignment, the
+// rest of the current chunk is abandoned
+static void ArenaAddChunk(Arena* a, size_t size, size_t align) {
+    INFO("Allocating new chunk");
+
+    size_t needed = sizeof(ArenaChunk) + size + align;
+    while(a->chunkSize < needed) {
+        a->chunkSize *= 2;
+    }
+
+    ArenaChunk* chunk = malloc(a->chunkSize);
+    if(chunk == NULL) {
+        FATAL("Could not create new chunk of %zu bytes", a->chunkSize);
+        exit(1);
+    }
+    chunk->previous = a->current;
+    chunk->end = (char*)(chunk + 1);
+    chunk->limit = (char*)chunk + a->chunkSize;
+    a->current = chunk;
+
+    atomic_fetch_add(&chunkCount, 1);
+    statsReserve(a->chunkSize);
+
+    DEBUG("Allocated %zu bytes", a->chunkSize);
+
+    // chunks grow geometrically so the number of chunks stays small
+    if(a->chunkSize < ARENA_MAX_CHUNK) {
+        a->chunkSize *= 2;
+    }
+}
+
+static void ArenaSetup(Arena* a) {
+    a->align = 2 * sizeof(void*);
+    a->chunkSize = ARENA_FIRST_CHUNK;
+    a->current = NULL;
+    a->last = NULL;
+    a->large = NULL;
+    a->largeSerial = 0;
+
+    // add an initial chunk
+    ArenaAddChunk(a, 0, a->align);
+}
+
 void ArenaInit() {
     CONTEXT(DEBUG, "Memory Initialization");
 
-    arena.pageSize = 4096 * 16;
+    pthread_mutex_lock(&statsLock);
+    threadStats.next = allStats;
+    allStats = &threadStats;
+    pthread_mutex_unlock(&statsLock);
+
+    ArenaSetup(&persistentArena);
+    arena = &persistentArena;
+}
+
+// threads other than the main thread set up their arena on first use
+static inline Arena* currentArena() {
+    if(arena == NULL) {
+        ArenaInit();
+    }
+    return arena;
+}
+
+// large blocks get their own mapping, with a header stored just before the
+// returned pointer so they can be released
+static void* ArenaAllocLarge(Arena* a, size_t size, size_t align) {
+    CONTEXT(DEBUG, "Large allocation of %zu bytes", size);
+
+    size_t header = sizeof(ArenaLarge);
+    size_t mapSize = size + header + align;
 
-    // add an initial page
-    arena.align = 2 * sizeof(void*);
-    arena.areas = malloc(sizeof(Arena));
-    arena.areas[0].end = malloc(arena.pageSize);
-    arena.arenaCount = 1;
-    if(arena.areas == NULL || arena.areas[0].end == NULL) {
-        FATAL("Could not allocate memory for arena");
+#ifdef _WIN32
+    char* base = malloc(mapSize);
+    if(base == NULL) {
+#else
+    char* base = mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED) {
+#endif
+        FATAL("Could not map %zu bytes for large allocation", mapSize);
         exit(1);
     }
-    arena.areas[0].bytesLeft = arena.pageSize;
-    DEBUG("Allocated %u bytes", arena.pageSize);
+
+    size_t offset = header + AlignForward(base + header, align);
+    ArenaLarge* large = (ArenaLarge*)(base + offset) - 1;
+    large->next = a->large;
+    large->owner = a;
+    large->serial = a->largeSerial++;
+    large->mapSize = mapSize;
+    large->offset = offset;
+    a->large = large;
+
+    atomic_fetch_add(&largeCount, 1);
+    statsReserve(mapSize);
+    statsRequest(size);
+
+    return large + 1;
+}
+
+static void ArenaUnmapLarge(ArenaLarge* large) {
+    atomic_fetch_sub(&largeCount, 1);
+    statsRelease(large->mapSize);
+    char* base = (char*)(large + 1) - large->offset;
+#ifdef _WIN32
+    (void)large;
+    free(base);
+#else
+    munmap(base, large->mapSize);
+#endif
+}
+
+// release a large block if it belongs to one of this thread's arenas, a block
+// from another thread is left as its owner's list cannot be safely changed
+static void ArenaFreeLarge(void* ptr) {
+    ArenaLarge* large = (ArenaLarge*)ptr - 1;
+    Arena* owner = large->owner;
+    if(owner != &persistentArena && owner != &scratchArenas[0] &&
+        owner != &scratchArenas[1]) {
+        return;
+    }
+
+    ArenaLarge** link = &owner->large;
+    while(*link != large) {
+        link = &(*link)->next;
+    }
+    *link = large->next;
+
+    ArenaUnmapLarge(large);
 }
 
 void* ArenaAlloc(size_t size) {
-    return ArenaAllocAlign(size, arena.align);
+    return ArenaAllocAlign(size, currentArena()->align);
 }
 
 void* ArenaAllocAlign(size_t size, size_t align) {
     CONTEXT(TRACE, "Arena Allocation");
 
-    void* ptr = NULL;
-    size_t i;
+    Arena* a = currentArena();
 
-    // find area with enough remaining memory
-    for(i = 0; i < arena.arenaCount; i++){
-        // ensure there is enough space incase the pointer needs re-aligning
-        if(arena.areas[i].bytesLeft > size + align){
-            ptr = (void*)arena.areas[i].end;
-            break;
-        }
+    if(size >= ARENA_LARGE_SIZE) {
+        return ArenaAllocLarge(a, size, align);
     }
 
-    // no large enough area found so add new area that is large enough
-    if(ptr == NULL) {
-        INFO("Allocating new page");
-
-        // ensure that new area will be large enough
-        if(arena.pageSize < size) {
-            arena.pageSize = size;
-        }
-
-        // expand the arena base pointer array
-        arena.arenaCount++;
-        arena.areas = realloc(arena.areas, sizeof(Arena)*arena.arenaCount);
-        if(arena.areas == NULL) {
-            FATAL("Could not expand arena area list from %u to %u",
-                arena.arenaCount-1, arena.arenaCount);
-            exit(1);
-        }
-
-        // allocate the area
-        arena.areas[arena.arenaCount-1].end = malloc(arena.pageSize);
-        if(arena.areas[arena.arenaCount-1].end == NULL) {
-            FATAL("Could not create new area");
-            exit(1);
-        }
-        ptr = (void*)arena.areas[arena.arenaCount-1].end;
-        arena.areas[arena.arenaCount-1].bytesLeft = arena.pageSize;
+    // bump allocate from the current chunk, only needing a new chunk if it
+    // is full
+    ArenaChunk* chunk = a->current;
+    int padding = AlignForward(chunk->end, align);
+    char* ptr = chunk->end + padding;
+    if(ptr + size > chunk->limit) {
+        ArenaAddChunk(a, size, align);
+        chunk = a->current;
+        padding = AlignForward(chunk->end, align);
+        ptr = chunk->end + padding;
     }
+    chunk->end = ptr + size;
+    a->last = ptr;
 
-    // align end pointer and ensure area's pointers are updated
-    int alignOffset = AlignForward((void*)((uintptr_t)arena.areas[i].end + size), align);
-    arena.areas[i].end = (void*)((uintptr_t)arena.areas[i].end + size + alignOffset);
-    arena.areas[i].bytesLeft -= size + alignOffset;
+    statsRequest(size);
+    threadStats.tags[currentTag].alignmentWaste += padding;
 
-    TRACE("Assigned %u bytes from arena, %u left until reallocation",
-        size + alignOffset, arena.areas[i].bytesLeft);
+    TRACE("Assigned %zu bytes from arena, %zu left in chunk",
+        size, (size_t)(chunk->limit - chunk->end));
     return ptr;
 }
 
 void* ArenaReAlloc(void* old_ptr, size_t old_size, size_t new_size) {
     CONTEXT(TRACE, "Array re-allocation");
+
+    Arena* a = currentArena();
+
+    // the most recent allocation can grow into the rest of its chunk
+    if(old_ptr != NULL && old_ptr == a->last && new_size < ARENA_LARGE_SIZE
+        && (char*)old_ptr + new_size <= a->current->limit) {
+        TRACE("Resized in place from %zu to %zu bytes", old_size, new_size);
+        a->current->end = (char*)old_ptr + new_size;
+        if(new_size > old_size) {
+            statsRequest(new_size - old_size);
+        }
+        return old_ptr;
+    }
+
     void* new_ptr = ArenaAlloc(new_size);
-    memcpy(new_ptr, old_ptr, old_size);
+    if(old_ptr != NULL) {
+        memcpy(new_ptr, old_ptr, old_size < new_size ? old_size : new_size);
+        if(old_size >= ARENA_LARGE_SIZE) {
+            ArenaFreeLarge(old_ptr);
+        } else {
+            threadStats.tags[currentTag].reallocWaste += old_size;
+        }
+    }
     return new_ptr;
 }
 
+ArenaMarker ArenaMark() {
+    Arena* a = currentArena();
+    return (ArenaMarker){
+        .arena = a,
+        .chunk = a->current,
+        .end = a->current->end,
+        .largeSerial = a->largeSerial
+    };
+}
+
+void ArenaRestore(ArenaMarker marker) {
+    CONTEXT(TRACE, "Arena restore");
+    Arena* a = marker.arena;
+
+    while(a->current != marker.chunk) {
+        ArenaChunk* previous = a->current->previous;
+        atomic_fetch_sub(&chunkCount, 1);
+        statsRelease(a->current->limit - (char*)a->current);
+        free(a->current);
+        a->current = previous;
+    }
+    a->current->end = marker.end;
+
+    while(a->large != NULL && a->large->serial >= marker.largeSerial) {
+        ArenaLarge* next = a->large->next;
+        ArenaUnmapLarge(a->large);
+        a->large = next;
+    }
+
+    a->last = NULL;
+}
+
+ArenaTemp ArenaTempBegin() {
+    Arena* previous = currentArena();
+
+    // use whichever scratch arena is not in use by the enclosing scope, so
+    // the enclosing scope can still allocate while this one is active
+    Arena* scratch = previous == &scratchArenas[0] ? &scratchArenas[1] :
+        &scratchArenas[0];
+    if(scratch->current == NULL) {
+        ArenaSetup(scratch);
+    }
+
+    arena = scratch;
+    return (ArenaTemp){
+        .marker = ArenaMark(),
+        .previous = previous
+    };
+}
+
+void ArenaTempEnd(ArenaTemp temp) {
+    ArenaRestore(temp.marker);
+    arena = temp.previous;
+}
+
+Arena* ArenaUsePersistent() {
+    Arena* previous = currentArena();
+    arena = &persistentArena;
+    return previous;
+}
+
+void ArenaScopeEnd(Arena** previous) {
+    arena = *previous;
+}
+
+MemoryTag MemoryTagSet(MemoryTag tag) {
+    MemoryTag previous = currentTag;
+    currentTag = tag;
+    return previous;
+}
+
+void MemoryTagEnd(MemoryTag* previous) {
+    currentTag = *previous;
+}
+
+MemoryTagStats MemoryGetTagStats(MemoryTag tag) {
+    MemoryTagStats total = {0};
+    pthread_mutex_lock(&statsLock);
+    for(ThreadMemoryStats* stats = allStats; stats != NULL; stats = stats->next) {
+        total.allocations += stats->tags[tag].allocations;
+        total.requested += stats->tags[tag].requested;
+        total.alignmentWaste += stats->tags[tag].alignmentWaste;
+        total.reallocWaste += stats->tags[tag].reallocWaste;
+    }
+    pthread_mutex_unlock(&statsLock);
+    return total;
+}
+
+size_t MemoryRequestedBytes() {
+    size_t total = 0;
+    pthread_mutex_lock(&statsLock);
+    for(ThreadMemoryStats* stats = allStats; stats != NULL; stats = stats->next) {
+        total += atomic_load_explicit(&stats->requested, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&statsLock);
+    return total;
+}
+
+void MemoryPrintStats(bool terminal) {
+    CONTEXT(INFO, "Memory statistics");
+
+    char line[128];
+    #define STATS_LINE(...) \
+        do { \
+            snprintf(line, sizeof(line), __VA_ARGS__); \
+            INFO("%s", line); \
+            if(terminal) { \
+                cErrPrintf(TextWhite, "%s\n", line); \
+            } \
+        } while(0)
+
+    STATS_LINE("%-12s %12s %14s %12s %12s", "subsystem", "allocations",
+        "bytes", "alignment", "realloc");
+    for(int i = 0; i < MEMORY_TAG_COUNT; i++) {
+        MemoryTagStats stats = MemoryGetTagStats(i);
+        STATS_LINE("%-12s %12zu %14zu %12zu %12zu", memoryTagNames[i],
+            stats.allocations, stats.requested, stats.alignmentWaste,
+            stats.reallocWaste);
+    }
+    STATS_LINE("chunks %zu, large blocks %zu, reserved %zu bytes, "
+        "peak %zu bytes", atomic_load(&chunkCount), atomic_load(&largeCount),
+        atomic_load(&reservedBytes), atomic_load(&peakReservedBytes));
+
+    #undef STATS_LINE
+}
+
 char* aprintf(const char* format, ...) {
     va_list args;
     va_start(args, format);
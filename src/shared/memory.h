@@ -6,21 +6,54 @@
 #include <stdarg.h>
 #include "shared/log.h"
 
-// section of memory
-typedef struct Area {
-    size_t bytesLeft;
-    void* end;
-} Area;
-
-// contains all memory in the program
+// block of memory allocations are bumped out of, the allocations directly
+// follow this header
+typedef struct ArenaChunk {
+    // chunk that was in use before this one
+    struct ArenaChunk* previous;
+
+    // next free byte and the end of the chunk
+    char* end;
+    char* limit;
+} ArenaChunk;
+
+// contains all memory allocated by a thread
 typedef struct Arena {
-    Area* areas;
-    size_t arenaCount;
-    size_t pageSize;
+    // chunk new allocations come from
+    ArenaChunk* current;
+
+    // size of the next chunk, grows each time a chunk is added
+    size_t chunkSize;
     size_t align;
+
+    // the most recent allocation, can be resized without copying
+    void* last;
+
+    // separately mapped blocks, most recent first, numbered in order
+    struct ArenaLarge* large;
+    size_t largeSerial;
 } Arena;
 
-// initialise the arena
+// position in an arena that it can be restored to
+typedef struct ArenaMarker {
+    Arena* arena;
+    ArenaChunk* chunk;
+    char* end;
+    size_t largeSerial;
+} ArenaMarker;
+
+// a temporary allocation scope
+typedef struct ArenaTemp {
+    ArenaMarker marker;
+    Arena* previous;
+} ArenaTemp;
+
+// allocations at least this large are mapped separately rather than taking
+// space in a chunk, and are released when they are re-allocated
+#define ARENA_LARGE_SIZE (4096 * 64)
+
+// initialise the calling thread's arena, other threads initialise theirs on
+// their first allocation
 void ArenaInit();
 
 // allocate memory in arena with default alignment
@@ -30,9 +63,72 @@ void* ArenaAlloc(size_t size);
 // align(bytes) bust be a power of 2
 void* ArenaAllocAlign(size_t size, size_t align);
 
-// resize a pointer alloced in the arena
+// resize a pointer alloced in the arena, old_size must be the size it was
+// allocated with.  Resizes in place if it was the thread's last allocation.
+// The old pointer must not be used afterwards, as large blocks are released
 void* ArenaReAlloc(void* old_ptr, size_t old_size, size_t new_size);
 
+// get the current position of the arena allocations come from
+ArenaMarker ArenaMark();
+
+// free everything allocated in the marker's arena since it was marked
+void ArenaRestore(ArenaMarker marker);
+
+// start a temporary scope, allocations until the matching ArenaTempEnd come
+// from a scratch arena and are freed when it ends.  Scopes can be nested, but
+// must be ended in the reverse order they were begun.
+ArenaTemp ArenaTempBegin();
+void ArenaTempEnd(ArenaTemp temp);
+
+// allocations in the rest of the enclosing block go to the thread's long
+// lived arena, even inside a temporary scope.  Used for anything that has to
+// outlive the temporary scope it is created in
+#define ARENA_PERSISTENT() \
+    Arena* _arena_previous_ __attribute__((cleanup(ArenaScopeEnd))) \
+        = ArenaUsePersistent()
+
+Arena* ArenaUsePersistent();
+void ArenaScopeEnd(Arena** previous);
+
+// subsystem memory is counted against
+typedef enum MemoryTag {
+    MEMORY_OTHER,
+    MEMORY_AST,
+    MEMORY_ANALYSIS,
+    MEMORY_GRAPH,
+    MEMORY_CODEGEN,
+    MEMORY_ERROR,
+    MEMORY_TAG_COUNT
+} MemoryTag;
+
+// counters for a subsystem, wasted bytes are lost to alignment padding or
+// left behind when an allocation is moved by a re-allocation
+typedef struct MemoryTagStats {
+    size_t allocations;
+    size_t requested;
+    size_t alignmentWaste;
+    size_t reallocWaste;
+} MemoryTagStats;
+
+// count allocations in the rest of the enclosing block against a subsystem
+#define MEMORY_TAG(tag) \
+    MemoryTag _memory_tag_previous_ __attribute__((cleanup(MemoryTagEnd))) \
+        = MemoryTagSet(tag)
+
+MemoryTag MemoryTagSet(MemoryTag tag);
+void MemoryTagEnd(MemoryTag* previous);
+
+// totals of every thread's counters for a subsystem
+MemoryTagStats MemoryGetTagStats(MemoryTag tag);
+
+// bytes requested by every thread so far, can be called while other threads
+// are allocating
+size_t MemoryRequestedBytes();
+
+// write memory use of every subsystem and the arena to the log, and to the
+// terminal if requested
+void MemoryPrintStats(bool terminal);
+
 // declare a new array in the current scope
 #define ARRAY_DEFINE(type, name) \
     type* name##s; \
@@ -4,11 +4,23 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <dirent.h>
+#include <time.h>
 #include "shared/platform.h"
 #include "shared/memory.h"
+#include "shared/buffer.h"
+#include "shared/table.h"
+#include "shared/log.h"
+
+#include <sys/stat.h>
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
 #endif
 
 const char* resolvePath(const char* path) {
@@ -27,6 +39,21 @@ const char* resolvePath(const char* path) {
 #endif
 }
 
+const char* executablePath() {
+#if defined(_WIN32)
+    char* buf = ArenaAlloc(MAX_PATH + 1);
+    DWORD length = GetModuleFileNameA(NULL, buf, MAX_PATH + 1);
+    return length == 0 || length > MAX_PATH ? NULL : buf;
+#elif defined(__APPLE__)
+    uint32_t size = PATH_MAX + 1;
+    char* buf = ArenaAlloc(size);
+    return _NSGetExecutablePath(buf, &size) == 0 ? buf : NULL;
+#else
+    // procfs links to the executable even if it has been moved
+    return "/proc/self/exe";
+#endif
+}
+
 #ifdef _WIN32
 // stderr handle
 static HANDLE HandleErr;
@@ -117,6 +144,30 @@ void cErrPutchar(TextColor color, char c) {
 #endif
 }
 
+void cErrWriteBuffer(ColorBuffer* buf) {
+    FILE* stream = streamForce ? forcedStream : stderr;
+    Buffer* text = &buf->text;
+#ifdef _WIN32
+    size_t start = 0;
+    for(unsigned int i = 0; i < buf->runCount; i++) {
+        ColorRun* run = &buf->runs[i];
+        fwrite(text->chars + start, 1, run->start - start, stream);
+        SetConsoleTextAttribute(HandleErr, run->color | FOREGROUND_INTENSITY);
+        start = run->start;
+    }
+    fwrite(text->chars + start, 1, text->charCount - start, stream);
+    if(buf->colored) {
+        SetConsoleTextAttribute(HandleErr, ErrReset.wAttributes);
+    }
+#else
+    if(buf->colored) {
+        bufferPuts(text, "\x1B[0m");
+    }
+    fwrite(text->chars, 1, text->charCount, stream);
+#endif
+    colorBufferClear(buf);
+}
+
 void printStreamForceOut() {
     streamForce = true;
     forcedStream = stdout;
@@ -151,6 +202,134 @@ const char* readFilePtr(FILE* file) {
     return buffer;
 }
 
+bool mapFile(const char* fileName, FileBuffer* buffer) {
+    FILE* file = fopen(fileName, "rb");
+    if(file == NULL) {
+        return false;
+    }
+    bool result = mapFilePtr(file, buffer);
+    fclose(file);
+    return result;
+}
+
+bool mapFilePtr(FILE* file, FileBuffer* buffer) {
+#ifndef _WIN32
+    // the mapping holds its own reference to the file, so is kept after the
+    // file is closed.  Empty files cannot be mapped
+    struct stat info;
+    if(fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode) &&
+       info.st_size > 0) {
+        void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE,
+            fileno(file), 0);
+        if(data != MAP_FAILED) {
+            buffer->data = data;
+            buffer->length = info.st_size;
+            return true;
+        }
+    }
+#endif
+
+    // the size is not known in advance, so read until the end of the stream
+    Buffer contents;
+    bufferInit(&contents);
+    char block[4096];
+    size_t bytesRead;
+    while((bytesRead = fread(block, sizeof(char), sizeof(block), file)) > 0) {
+        bufferWrite(&contents, block, bytesRead);
+    }
+
+    buffer->data = contents.chars;
+    buffer->length = contents.charCount;
+    return !ferror(file);
+}
+
+bool getFileVersion(const char* fileName, FileVersion* version) {
+    struct stat info;
+    if(stat(fileName, &info) != 0) {
+        return false;
+    }
+
+#if defined(_WIN32)
+    version->modified = (long long)info.st_mtime * 1000000000;
+#elif defined(__APPLE__)
+    version->modified = (long long)info.st_mtimespec.tv_sec * 1000000000 +
+        info.st_mtimespec.tv_nsec;
+#else
+    version->modified = (long long)info.st_mtim.tv_sec * 1000000000 +
+        info.st_mtim.tv_nsec;
+#endif
+    version->size = info.st_size;
+    return true;
+}
+
+bool writeFileIfChanged(const char* fileName, const char* data, size_t length) {
+    CONTEXT(INFO, "Writing %s", fileName);
+
+    FILE* file = fopen(fileName, "rb");
+    if(file != NULL) {
+        const char* old = readFilePtr(file);
+        long oldLength = ftell(file);
+        fclose(file);
+
+        if(oldLength >= 0 && (size_t)oldLength == length &&
+            memcmp(old, data, length) == 0) {
+            INFO("Content unchanged, leaving file untouched");
+            return true;
+        }
+    }
+
+    file = fopen(fileName, "wb");
+    if(file == NULL) {
+        return false;
+    }
+    size_t written = fwrite(data, sizeof(char), length, file);
+    fclose(file);
+    return written == length;
+}
+
+bool makeDirectory(const char* path) {
+#ifdef _WIN32
+    if(CreateDirectoryA(path, NULL)) {
+        return true;
+    }
+#else
+    if(mkdir(path, 0777) == 0) {
+        return true;
+    }
+#endif
+
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+double monotonicTime() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+#endif
+}
+
+double processorTime() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    ULARGE_INTEGER kernelTime = {{kernel.dwLowDateTime, kernel.dwHighDateTime}};
+    ULARGE_INTEGER userTime = {{user.dwLowDateTime, user.dwHighDateTime}};
+    return (kernelTime.QuadPart + userTime.QuadPart) / 1e7;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+#endif
+}
+
 const char pathSeperator =
 #ifdef _WIN32
     '\\';
@@ -158,10 +337,8 @@ const char pathSeperator =
     '/';
 #endif
 
-bool iterateDirectory(const char* basePath, directoryCallback callback) {
-    // assumes path max as 1000
-    char path[1000];
-
+bool iterateDirectory(const char* basePath, directoryCallback callback,
+    void* data) {
     // uses dirent.h
     DIR* directory = opendir(basePath);
     struct dirent *entry;
@@ -171,34 +348,43 @@ bool iterateDirectory(const char* basePath, directoryCallback callback) {
         return false;
     }
 
-    bool result = false;
-
     // foreach entry in the directory
     while((entry = readdir(directory)) != NULL) {
         // ignore current and parent directory
-        if(strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-
-            const char pathSepString[] = {pathSeperator, '\0'};
-
-            // contruct path to found file or folder
-            strcpy(path, basePath);
-            strcat(path, pathSepString);
-            strcat(path, entry->d_name);
-
-            // try to open it as a file. if it fails, it must be a directory
-            // so iterate it.
-            FILE* file = fopen(path, "r");
-            if(file == NULL) {
-                fclose(file);
-                result = result || iterateDirectory(path, callback);
-            } else {
-                // otherwise file found, read it and run callback on it.
-                callback(path, readFilePtr(file));
-                fclose(file);
-                result = true;
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        // contruct path to found file or folder
+        const char* path = aprintf("%s%c%s", basePath, pathSeperator,
+            entry->d_name);
+
+        // the entry's type is usually known from the directory listing,
+        // otherwise or for links, stat the path to find what it refers to
+        bool isDirectory = false;
+        bool isFile = false;
+#ifdef _DIRENT_HAVE_D_TYPE
+        if(entry->d_type == DT_DIR) {
+            isDirectory = true;
+        } else if(entry->d_type == DT_REG) {
+            isFile = true;
+        } else if(entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+#endif
+        {
+            struct stat info;
+            if(stat(path, &info) == 0) {
+                isDirectory = S_ISDIR(info.st_mode);
+                isFile = S_ISREG(info.st_mode);
             }
         }
+
+        if(isDirectory) {
+            iterateDirectory(path, callback, data);
+        } else if(isFile) {
+            callback(path, data);
+        }
     }
 
-    return result;
+    closedir(directory);
+    return true;
 }
@@ -4,10 +4,15 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stddef.h>
 
 // convert an relative path into an absolute path
 const char* resolvePath(const char* path);
 
+// path that can be used to open the running program's executable, returns
+// NULL if it cannot be found
+const char* executablePath();
+
 // terminal text output color
 typedef enum TextColor {
 #ifdef _WIN32
@@ -55,20 +60,66 @@ void cOutVPrintf(TextColor color, const char* format, va_list args);
 // putchar a character with a given color to stderr
 void cErrPutchar(TextColor color, char c);
 
+struct ColorBuffer;
+
+// write the contents of a color buffer to stderr in one write, then empty it
+void cErrWriteBuffer(struct ColorBuffer* buf);
+
 // get a buffer containing the string contents of the filename provided
 const char* readFile(const char* fileName);
 
 // get a buffer containing the string contents of the file pointer provided
 const char* readFilePtr(FILE* file);
 
-// function called while iterating a directory, passed the path to a file
-// and a buffer containing the contents of that file
-typedef void(*directoryCallback)(const char* path, const char* file);
-
-// Run a function for every file in a directory, and recurse for
-// all folders in the directory
-// returns true if it ran the callback
-bool iterateDirectory(const char* basePath, directoryCallback callback);
+// contents of a source file, not null terminated
+typedef struct FileBuffer {
+    const char* data;
+    size_t length;
+} FileBuffer;
+
+// map a file read only into memory, falling back to reading it when it cannot
+// be mapped, e.g. a pipe.  The contents stay valid until the program exits.
+// returns false if the file could not be opened
+bool mapFile(const char* fileName, FileBuffer* buffer);
+
+// map an already open file, the file can be closed afterwards
+bool mapFilePtr(FILE* file, FileBuffer* buffer);
+
+// identifies a version of a file without reading it, a file that has been
+// changed will almost certainly have a different version
+typedef struct FileVersion {
+    long long modified;
+    long long size;
+} FileVersion;
+
+// get the current version of a file, returns false if it does not exist
+bool getFileVersion(const char* fileName, FileVersion* version);
+
+// write length bytes of data to a file, unless the file already has exactly
+// that content, so its modification time is only changed by real changes.
+// returns false if the file could not be written
+bool writeFileIfChanged(const char* fileName, const char* data, size_t length);
+
+// create a directory if it does not already exist, its parent must exist.
+// returns false if the directory could not be created
+bool makeDirectory(const char* path);
+
+// function called while iterating a directory, passed the path to a file,
+// allocated in the current arena, and the data given to iterateDirectory
+typedef void(*directoryCallback)(const char* path, void* data);
+
+// Run a function for every regular file in a directory, and recurse for
+// all folders in the directory.  Files are visited in the order the directory
+// lists them.
+// returns false if the path could not be opened as a directory
+bool iterateDirectory(const char* basePath, directoryCallback callback,
+    void* data);
+
+// seconds since an arbitrary point, only useful for measuring durations
+double monotonicTime();
+
+// seconds of processor time used by every thread of the program
+double processorTime();
 
 // the character to use to seperate sections in a path
 extern const char pathSeperator;
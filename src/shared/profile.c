@@ -0,0 +1,233 @@
+#include "shared/profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "shared/platform.h"
+#include "shared/memory.h"
+
+// a context that has finished, times are in seconds since profiling started
+typedef struct ProfileSpan {
+    const char* filename;
+    const char* line;
+    const char* function;
+    double start;
+    double duration;
+    double self;
+} ProfileSpan;
+
+// spans are kept per thread, so recording one never waits for another thread.
+// Uses malloc as the arena's own contexts are timed
+typedef struct ProfileThread ProfileThread;
+struct ProfileThread {
+    ProfileThread* next;
+    unsigned int id;
+    ProfileSpan* spans;
+    size_t spanCount;
+    size_t spanCapacity;
+};
+
+bool _profile_enabled_ = false;
+static double profileOrigin;
+
+static pthread_mutex_t threadsLock = PTHREAD_MUTEX_INITIALIZER;
+static ProfileThread* threads = NULL;
+static unsigned int threadTotal = 0;
+static _Thread_local ProfileThread* profileThread = NULL;
+
+static ProfileThread* getThread() {
+    if(profileThread == NULL) {
+        ProfileThread* thread = calloc(1, sizeof(ProfileThread));
+        if(thread == NULL) {
+            abort();
+        }
+        pthread_mutex_lock(&threadsLock);
+        thread->id = threadTotal++;
+        thread->next = threads;
+        threads = thread;
+        pthread_mutex_unlock(&threadsLock);
+        profileThread = thread;
+    }
+    return profileThread;
+}
+
+void profileStart() {
+    // the calling thread is listed first
+    getThread();
+    profileOrigin = monotonicTime();
+    _profile_enabled_ = true;
+}
+
+void profileContextBegin(LogContext* ctx) {
+    ctx->timed = true;
+    ctx->childTime = 0;
+    ctx->start = monotonicTime();
+}
+
+void profileContextEnd(LogContext* ctx) {
+    double duration = monotonicTime() - ctx->start;
+
+    // the enclosing context's self time excludes this one
+    if(ctx->next != NULL && ctx->next->timed) {
+        ctx->next->childTime += duration;
+    }
+
+    ProfileThread* thread = getThread();
+    if(thread->spanCount == thread->spanCapacity) {
+        size_t capacity = thread->spanCapacity == 0 ? 1024 :
+            thread->spanCapacity * 2;
+        ProfileSpan* spans = realloc(thread->spans,
+            capacity * sizeof(ProfileSpan));
+        if(spans == NULL) {
+            abort();
+        }
+        thread->spans = spans;
+        thread->spanCapacity = capacity;
+    }
+
+    ProfileSpan* span = &thread->spans[thread->spanCount++];
+    span->filename = ctx->filename;
+    span->line = ctx->line;
+    span->function = ctx->function;
+    span->start = ctx->start - profileOrigin;
+    span->duration = duration;
+    span->self = duration - ctx->childTime;
+}
+
+static void writeJsonString(FILE* file, const char* str) {
+    fputc('"', file);
+    for(const char* c = str; *c != '\0'; c++) {
+        if(*c == '"' || *c == '\\') {
+            fputc('\\', file);
+        }
+        fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+bool profileWrite(const char* fileName) {
+    // stop timing, so the spans do not move while they are written
+    _profile_enabled_ = false;
+    CONTEXT(INFO, "Writing profile");
+
+    FILE* file = fopen(fileName, "w");
+    if(file == NULL) {
+        return false;
+    }
+
+    // times in microseconds, as the trace event format expects
+    fputs("{\"traceEvents\":[\n", file);
+    bool first = true;
+    pthread_mutex_lock(&threadsLock);
+    for(ProfileThread* thread = threads; thread != NULL; thread = thread->next) {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}", first ? "" : ",\n",
+            thread->id, thread->id == 0 ? "main" : "thread", thread->id);
+        first = false;
+
+        for(size_t i = 0; i < thread->spanCount; i++) {
+            ProfileSpan* span = &thread->spans[i];
+            fputs(",\n{\"name\":", file);
+            writeJsonString(file, span->function);
+            fputs(",\"cat\":", file);
+            writeJsonString(file, span->filename);
+            fprintf(file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,"
+                "\"tid\":%u,\"args\":{\"line\":%s}}", span->start * 1e6,
+                span->duration * 1e6, thread->id, span->line);
+        }
+    }
+    pthread_mutex_unlock(&threadsLock);
+    fputs("\n]}\n", file);
+
+    return fclose(file) == 0;
+}
+
+// total time spent in every context declared at the same place
+typedef struct ProfileSite {
+    const ProfileSpan* span;
+    unsigned int calls;
+    double total;
+    double self;
+} ProfileSite;
+
+static int spanSiteSort(const void* a, const void* b) {
+    const ProfileSpan* spanA = *(const ProfileSpan* const*)a;
+    const ProfileSpan* spanB = *(const ProfileSpan* const*)b;
+    int cmp = strcmp(spanA->filename, spanB->filename);
+    if(cmp != 0) {
+        return cmp;
+    }
+    cmp = atoi(spanA->line) - atoi(spanB->line);
+    if(cmp != 0) {
+        return cmp;
+    }
+    return strcmp(spanA->function, spanB->function);
+}
+
+static int siteSelfSort(const void* a, const void* b) {
+    double selfA = ((const ProfileSite*)a)->self;
+    double selfB = ((const ProfileSite*)b)->self;
+    return (selfA < selfB) - (selfA > selfB);
+}
+
+void profilePrintStats(bool terminal) {
+    _profile_enabled_ = false;
+    CONTEXT(INFO, "Profile statistics");
+    ArenaTemp temp = ArenaTempBegin();
+
+    pthread_mutex_lock(&threadsLock);
+    size_t spanCount = 0;
+    for(ProfileThread* thread = threads; thread != NULL; thread = thread->next) {
+        spanCount += thread->spanCount;
+    }
+    const ProfileSpan** spans = ArenaAlloc(sizeof(ProfileSpan*) *
+        (spanCount + 1));
+    size_t index = 0;
+    for(ProfileThread* thread = threads; thread != NULL; thread = thread->next) {
+        for(size_t i = 0; i < thread->spanCount; i++) {
+            spans[index++] = &thread->spans[i];
+        }
+    }
+    pthread_mutex_unlock(&threadsLock);
+
+    qsort(spans, spanCount, sizeof(ProfileSpan*), spanSiteSort);
+
+    ProfileSite* sites = ArenaAlloc(sizeof(ProfileSite) * (spanCount + 1));
+    size_t siteCount = 0;
+    for(size_t i = 0; i < spanCount; i++) {
+        if(siteCount == 0 ||
+           spanSiteSort(&sites[siteCount - 1].span, &spans[i]) != 0) {
+            sites[siteCount++] = (ProfileSite){spans[i], 0, 0, 0};
+        }
+        ProfileSite* site = &sites[siteCount - 1];
+        site->calls++;
+        site->total += spans[i]->duration;
+        site->self += spans[i]->self;
+    }
+
+    qsort(sites, siteCount, sizeof(ProfileSite), siteSelfSort);
+
+    char line[256];
+    #define STATS_LINE(...) \
+        do { \
+            snprintf(line, sizeof(line), __VA_ARGS__); \
+            INFO("%s", line); \
+            if(terminal) { \
+                cErrPrintf(TextWhite, "%s\n", line); \
+            } \
+        } while(0)
+
+    STATS_LINE("%12s %12s %10s  %s", "self ms", "total ms", "calls",
+        "context");
+    for(size_t i = 0; i < siteCount; i++) {
+        ProfileSite* site = &sites[i];
+        STATS_LINE("%12.3f %12.3f %10u  %s (%s:%s)", site->self * 1000,
+            site->total * 1000, site->calls, site->span->function,
+            site->span->filename, site->span->line);
+    }
+
+    #undef STATS_LINE
+
+    ArenaTempEnd(temp);
+}
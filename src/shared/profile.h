@@ -0,0 +1,22 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include "shared/log.h"
+
+// While profiling, every CONTEXT is timed from where it is declared until it
+// goes out of scope.  Contexts for levels that are compiled out are not timed.
+
+// start timing contexts, must be called before any other threads are started
+void profileStart();
+
+// stop timing and write every timed context as a Chrome trace event file,
+// which can be opened in chrome://tracing or Perfetto.  returns false if the
+// file could not be written
+bool profileWrite(const char* fileName);
+
+// stop timing and write the time spent in each context, excluding contexts
+// nested in it, to the log and to the terminal if requested
+void profilePrintStats(bool terminal);
+
+#endif
@@ -3,17 +3,47 @@
 #include "shared/table.h"
 #include "shared/memory.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// control bytes, a slot in use holds the top 7 bits of its hash instead
+#define CONTROL_EMPTY 0x80
+#define CONTROL_DELETED 0xFE
+
 uint32_t strHash(void* value) {
-    // fnv-1a hash calculation
     // assumes null-terminated string
     char* str = value;
-    uint32_t hash = 2166126261u;
+    return (uint32_t)hashBytes(str, strlen(str));
+}
+
+uint64_t hashBytes(const void* data, size_t length) {
+    // multiply and xor-shift each 8 byte word into the hash, then mix the
+    // result so every input bit affects every output bit
+    const unsigned char* bytes = data;
+    uint64_t hash = 0x9E3779B97F4A7C15u ^ length;
+
+    while(length >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        hash = (hash ^ word) * 0xBF58476D1CE4E5B9u;
+        hash ^= hash >> 31;
+        bytes += 8;
+        length -= 8;
+    }
 
-    for(size_t i = 0; i < strlen(str); i++) {
-        hash ^= str[i];
-        hash *= 16777619;
+    if(length > 0) {
+        uint64_t word = 0;
+        memcpy(&word, bytes, length);
+        hash = (hash ^ word) * 0xBF58476D1CE4E5B9u;
+        hash ^= hash >> 31;
     }
 
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9u;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBu;
+    hash ^= hash >> 31;
     return hash;
 }
 
@@ -24,153 +54,252 @@ bool strCmp(void* a, void* b) {
     return strcmp(tokA, tokB) == 0;
 }
 
-// create new hash table
-void initTable(Table* table, HashFn hashfn, KeyCompare cmp) {
-    table->count = 0;
-    table->capacity = 0;
-    table->entries = NULL;
-    table->hash = hashfn;
-    table->cmp = cmp;
+// spread the bits of a user provided hash, as both the low bits (slot) and
+// high bits (control byte) are used
+static uint32_t mixHash(uint32_t hash) {
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+    return hash;
 }
 
-// find an entry in a list of entries
-static Entry* findEntry(Entry* entries, int capacity, Key* key, KeyCompare cmp) {
+static uint8_t controlByte(uint32_t hash) {
+    return hash >> 25;
+}
 
-    // location to start searching
-    uint32_t index = key->hash % capacity;
+// bitmask of the slots in a group whose control byte equals byte
+static uint32_t groupMatch(const uint8_t* group, uint8_t byte) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    __m128i match = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte));
+    return (uint32_t)_mm_movemask_epi8(match);
+#else
+    uint32_t mask = 0;
+    for(unsigned int i = 0; i < TABLE_GROUP_SIZE; i++) {
+        if(group[i] == byte) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+// bitmask of the slots in a group that are empty or deleted
+static uint32_t groupFree(const uint8_t* group) {
+#ifdef __SSE2__
+    // both free control bytes have the top bit set, a used one does not
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(ctrl);
+#else
+    uint32_t mask = 0;
+    for(unsigned int i = 0; i < TABLE_GROUP_SIZE; i++) {
+        if(group[i] & 0x80) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
 
-    while(true) {
-        // value to check
-        Entry* entry = &entries[index];
+// groups are probed in triangular steps, which visits every group as the
+// group count is a power of 2
+#define PROBE_START(hash, capacity) \
+    (((hash) & ((capacity) - 1)) & ~(unsigned int)(TABLE_GROUP_SIZE - 1))
+#define PROBE_NEXT(index, step, capacity) \
+    (((index) + (step) * TABLE_GROUP_SIZE) & ((capacity) - 1))
+
+// find the slot holding key, or -1 if it is not in the table
+static int findEntry(Table* table, Key* key) {
+    uint8_t byte = controlByte(key->hash);
+    unsigned int index = PROBE_START(key->hash, table->capacity);
+
+    for(unsigned int step = 1; step <= table->capacity / TABLE_GROUP_SIZE; step++) {
+        const uint8_t* group = &table->control[index];
+
+        uint32_t match = groupMatch(group, byte);
+        while(match != 0) {
+            unsigned int slot = index + __builtin_ctz(match);
+            match &= match - 1;
+
+            Entry* entry = &table->entries[slot];
+            if(entry->key.hash == key->hash &&
+               table->cmp(entry->key.value, key->value)) {
+                return slot;
+            }
+        }
 
-        // if run out of entries to check or the correct entry is found,
-        // return current search item
-        if(entry->key.value == NULL || cmp(entry->key.value, key->value)) {
-            return entry;
+        // the key would have been placed in an empty slot in this group
+        if(groupMatch(group, CONTROL_EMPTY) != 0) {
+            return -1;
         }
 
-        // get next location, wrapping round to index 0
-        index = (index + 1) % capacity;
+        index = PROBE_NEXT(index, step, table->capacity);
     }
+
+    return -1;
 }
 
-// increase the size of a table to the given capacity
+// find the first empty or deleted slot a key could be placed in
+static unsigned int findFree(uint8_t* control, unsigned int capacity, uint32_t hash) {
+    unsigned int index = PROBE_START(hash, capacity);
+
+    for(unsigned int step = 1; ; step++) {
+        uint32_t free = groupFree(&control[index]);
+        if(free != 0) {
+            return index + __builtin_ctz(free);
+        }
+        index = PROBE_NEXT(index, step, capacity);
+    }
+}
+
+// create new hash table
+void initTable(Table* table, HashFn hashfn, KeyCompare cmp) {
+    table->count = 0;
+    table->used = 0;
+    table->capacity = 0;
+    table->control = NULL;
+    table->entries = NULL;
+    table->hash = hashfn;
+    table->cmp = cmp;
+}
+
+// rehash a table into the given capacity, dropping any deleted slots
 static void adjustCapacity(Table* table, unsigned int capacity) {
 
     // create new data section and null initialise
+    uint8_t* control = ArenaAlloc(capacity);
     Entry* entries = ArenaAlloc(sizeof(Entry) * capacity);
-    for(unsigned int i = 0; i < capacity; i++) {
-        entries[i].key.value = NULL;
-        entries[i].value = NULL;
-    }
+    memset(control, CONTROL_EMPTY, capacity);
+    memset(entries, 0, sizeof(Entry) * capacity);
 
-    // copy data from the table to the new data section
-    // re-organises table for new memory size not just
-    // copying the data across.
+    // every key is already unique, so only a free slot has to be found
     for(unsigned int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
         if(entry->key.value == NULL) {
             continue;
         }
 
-        Entry* dest = findEntry(entries, capacity, &entry->key, table->cmp);
-        dest->key = entry->key;
-        dest->value = entry->value;
+        unsigned int slot = findFree(control, capacity, entry->key.hash);
+        control[slot] = controlByte(entry->key.hash);
+        entries[slot] = *entry;
     }
 
     // set the table's data to the new data
+    table->control = control;
     table->entries = entries;
     table->capacity = capacity;
+    table->used = table->count;
 }
 
-
 bool tableSet(Table* table, void* voidKey, void* value) {
     // create the key to be inserted into the table
     Key key;
     key.value = voidKey;
-    key.hash = table->hash(voidKey);
+    key.hash = mixHash(table->hash(voidKey));
+
+    if(table->capacity > 0) {
+        int existing = findEntry(table, &key);
+        if(existing >= 0) {
+            table->entries[existing].key = key;
+            table->entries[existing].value = value;
+            return false;
+        }
+    }
 
-    // make sure the table is big enough
-    if(table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = table->capacity;
-        capacity = capacity < 8 ? 8 : capacity * 2;
+    // make sure the table is big enough, keep at most 7/8 of the slots used,
+    // only growing if the rehash would not free enough deleted slots
+    if(table->used + 1 > table->capacity / 8 * 7) {
+        unsigned int capacity = table->capacity;
+        if(capacity < TABLE_GROUP_SIZE) {
+            capacity = TABLE_GROUP_SIZE;
+        } else if(table->count + 1 > capacity / 2) {
+            capacity *= 2;
+        }
         adjustCapacity(table, capacity);
     }
 
-    // get the entry to be set
-    Entry* entry = findEntry(table->entries, table->capacity, &key, table->cmp);
-
-    // does the entry have any content?
-    bool isNewKey = entry->key.value == NULL;
-    if(isNewKey) {
-        table->count++;
+    unsigned int slot = findFree(table->control, table->capacity, key.hash);
+    if(table->control[slot] == CONTROL_EMPTY) {
+        table->used++;
     }
-
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+    table->control[slot] = controlByte(key.hash);
+    table->entries[slot].key = key;
+    table->entries[slot].value = value;
+    table->count++;
+    return true;
 }
 
 bool tableGet(Table* table, void* voidKey, void** value) {
     // if nothing has been set then get will always be false
-    if(table->entries == NULL) {
+    if(table->count == 0) {
         return false;
     }
 
     // create key to search for
     Key key;
     key.value = voidKey;
-    key.hash = table->hash(voidKey);
+    key.hash = mixHash(table->hash(voidKey));
 
-    // find location where the key should be
-    Entry* entry = findEntry(table->entries, table->capacity, &key, table->cmp);
-    if(entry->key.value == NULL) {
+    int slot = findEntry(table, &key);
+    if(slot < 0) {
         return false;
     }
 
-    *value = entry->value;
+    *value = table->entries[slot].value;
     return true;
 }
 
 bool tableGetKey(Table* table, void* voidKey, void** realkey) {
-    if(table->entries == NULL) {
+    if(table->count == 0) {
         return false;
     }
 
     Key key;
     key.value = voidKey;
-    key.hash = table->hash(voidKey);
-
-    Entry* entry = findEntry(table->entries, table->capacity, &key, table->cmp);
-    *realkey = entry->key.value;
+    key.hash = mixHash(table->hash(voidKey));
 
-    return entry->key.value != NULL;
-}
-
-bool tableHas(Table* table, void* key) {
-    if(table->entries == NULL) {
+    int slot = findEntry(table, &key);
+    if(slot < 0) {
         return false;
     }
 
-    Key test;
-    test.value = key;
-    test.hash = table->hash(key);
-
-    Entry* entry = findEntry(table->entries, table->capacity, &test, table->cmp);
+    *realkey = table->entries[slot].key.value;
+    return true;
+}
 
-    // if the item is in the table, its key will not be null
-    return !(entry->key.value == NULL);
+bool tableHas(Table* table, void* key) {
+    void* value;
+    return tableGet(table, key, &value);
 }
 
 void tableRemove(Table* table, void* key) {
-    if(table->entries == NULL) {
+    if(table->count == 0) {
         return;
     }
 
     Key test;
     test.value = key;
-    test.hash = table->hash(key);
+    test.hash = mixHash(table->hash(key));
+
+    int slot = findEntry(table, &test);
+    if(slot < 0) {
+        return;
+    }
 
-    Entry* entry = findEntry(table->entries, table->capacity, &test, table->cmp);
-    entry->key.value = NULL;
-}
\ No newline at end of file
+    // a lookup stops at the first group with an empty slot, so the slot can
+    // only be marked empty if its group already has one, otherwise it has to
+    // be kept as deleted so later slots can still be found
+    unsigned int group = slot & ~(unsigned int)(TABLE_GROUP_SIZE - 1);
+    if(groupMatch(&table->control[group], CONTROL_EMPTY) != 0) {
+        table->control[slot] = CONTROL_EMPTY;
+        table->used--;
+    } else {
+        table->control[slot] = CONTROL_DELETED;
+    }
+
+    table->entries[slot].key.value = NULL;
+    table->entries[slot].value = NULL;
+    table->count--;
+}
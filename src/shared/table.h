@@ -5,12 +5,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-// percentage full that a table should expand at
-#define TABLE_MAX_LOAD 0.75
+// slots are probed in groups of this many, one control byte per slot
+#define TABLE_GROUP_SIZE 16
 
 // wrapper around key object
 typedef struct Key {
-    // pointer to object being used as key e.g. token, string
+    // pointer to object being used as key e.g. token, string, NULL if the
+    // slot is not in use
     void* value;
 
     // hash of the void* pointer in the key
@@ -29,12 +30,20 @@ typedef uint32_t(*HashFn)(void*);
 // are the two objects the same? (e.g. strcmp)
 typedef bool(*KeyCompare)(void*, void*);
 
-// Hash table
+// Hash table, open addressing with a control byte per slot holding either
+// the top 7 bits of the slot's hash or whether it is empty or deleted.  A
+// lookup compares a group of control bytes at once and only calls cmp on
+// slots whose byte matches.  Iterate through the table by checking every
+// entry for a non-NULL key.value.
 typedef struct Table {
     // number of items in the table
     unsigned int count;
 
-    // maximum number of items in the table
+    // number of items and deleted slots, slots that cannot be used without
+    // a rehash
+    unsigned int used;
+
+    // number of slots in the table, 0 or a power of 2
     unsigned int capacity;
 
     // how should the keys be hashed
@@ -43,6 +52,9 @@ typedef struct Table {
     // how should the keys be compared
     KeyCompare cmp;
 
+    // control byte for each slot
+    uint8_t* control;
+
     // the key-value array
     Entry* entries;
 } Table;
@@ -53,6 +65,9 @@ uint32_t strHash(void* value);
 // key comparison function for const char* keys
 bool strCmp(void* a, void* b);
 
+// 64 bit hash of an arbitrary block of memory, not stable between builds
+uint64_t hashBytes(const void* data, size_t length);
+
 // initialise a table
 void initTable(Table* table, HashFn hash, KeyCompare cmp);
 
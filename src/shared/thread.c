@@ -0,0 +1,139 @@
+#include "shared/thread.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "shared/log.h"
+
+// the pool is created on the first parallel loop, the workers then wait for
+// the generation to change, run as many iterations as they can claim and
+// check in so the caller knows when the loop is done
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t workDone = PTHREAD_COND_INITIALIZER;
+
+static unsigned int requestedCount = 1;
+static unsigned int workerCount = 0;
+static bool poolStarted = false;
+
+// the loop currently being run
+static unsigned int generation = 0;
+static ParallelFn jobFn;
+static void* jobData;
+static unsigned int jobCount;
+static atomic_uint jobNext;
+static unsigned int jobActive;
+
+// set while a thread is running loop iterations, so nested loops do not wait
+// on the pool they are part of
+static _Thread_local bool inLoop = false;
+
+static unsigned int processorCount() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count < 1 ? 1 : count;
+#endif
+}
+
+void threadSetCount(unsigned int count) {
+    requestedCount = count == 0 ? processorCount() : count;
+    INFO("Using %u threads", requestedCount);
+}
+
+unsigned int threadCount() {
+    return requestedCount;
+}
+
+// claim and run iterations until there are none left
+static void runIterations() {
+    inLoop = true;
+    unsigned int i;
+    while((i = atomic_fetch_add(&jobNext, 1)) < jobCount) {
+        jobFn(jobData, i);
+    }
+    inLoop = false;
+}
+
+static void* worker(void* arg) {
+    (void)arg;
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&poolLock);
+    while(true) {
+        while(generation == seen) {
+            pthread_cond_wait(&workReady, &poolLock);
+        }
+        seen = generation;
+        pthread_mutex_unlock(&poolLock);
+
+        runIterations();
+
+        pthread_mutex_lock(&poolLock);
+        jobActive--;
+        if(jobActive == 0) {
+            pthread_cond_signal(&workDone);
+        }
+    }
+
+    return NULL;
+}
+
+static void startPool() {
+    CONTEXT(INFO, "Starting thread pool");
+    poolStarted = true;
+
+    for(unsigned int i = 1; i < requestedCount; i++) {
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, worker, NULL) != 0) {
+            WARN("Could not create worker thread, continuing with %u",
+                workerCount);
+            break;
+        }
+        pthread_detach(thread);
+        workerCount++;
+    }
+}
+
+void parallelFor(unsigned int count, ParallelFn fn, void* data) {
+    // not worth waking the pool, or the pool is already busy with the loop
+    // this one is nested in
+    if(requestedCount <= 1 || count <= 1 || inLoop) {
+        for(unsigned int i = 0; i < count; i++) {
+            fn(data, i);
+        }
+        return;
+    }
+
+    if(!poolStarted) {
+        startPool();
+    }
+
+    pthread_mutex_lock(&poolLock);
+    jobFn = fn;
+    jobData = data;
+    jobCount = count;
+    atomic_store(&jobNext, 0);
+    jobActive = workerCount;
+    generation++;
+    pthread_cond_broadcast(&workReady);
+    pthread_mutex_unlock(&poolLock);
+
+    runIterations();
+
+    // every worker has to check in before the job can be replaced
+    pthread_mutex_lock(&poolLock);
+    while(jobActive > 0) {
+        pthread_cond_wait(&workDone, &poolLock);
+    }
+    pthread_mutex_unlock(&poolLock);
+}
@@ -0,0 +1,19 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+// work function run once for every index of a parallel loop
+typedef void (*ParallelFn)(void* data, unsigned int index);
+
+// set how many threads, including the calling thread, parallel loops can use.
+// 0 uses one thread per processor.  Must be called before the first loop runs
+void threadSetCount(unsigned int count);
+
+// number of threads parallel loops will use
+unsigned int threadCount();
+
+// run fn for every index in [0, count) spread across the thread pool, the
+// calling thread also runs iterations.  Returns once every index has finished.
+// Nested loops run on the calling thread only.
+void parallelFor(unsigned int count, ParallelFn fn, void* data);
+
+#endif
@@ -0,0 +1,179 @@
+#include "shared/timeReport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "shared/platform.h"
+#include "shared/memory.h"
+#include "shared/log.h"
+
+#define STAGE_MAX 16
+
+// opcodes listed individually, the rest are only counted in the total
+#define OPCODE_REPORT_COUNT 20
+
+typedef struct Stage {
+    const char* name;
+    const char* itemName;
+    double wall;
+    double cpu;
+    size_t requested;
+    size_t items;
+    unsigned int runs;
+} Stage;
+
+typedef struct OpcodeTime {
+    const char* name;
+    unsigned int possibilities;
+    double wall;
+    double cpu;
+} OpcodeTime;
+
+static bool enabled = false;
+
+// stages are kept in the order they first finish
+static pthread_mutex_t reportLock = PTHREAD_MUTEX_INITIALIZER;
+static Stage stages[STAGE_MAX];
+static unsigned int stageCount = 0;
+static OpcodeTime* opcodes = NULL;
+static size_t opcodeCount = 0;
+static size_t opcodeCapacity = 0;
+
+void timeReportStart() {
+    enabled = true;
+}
+
+bool timeReportEnabled() {
+    return enabled;
+}
+
+StageTimer stageBegin() {
+    if(!enabled) {
+        return (StageTimer){0};
+    }
+    return (StageTimer){
+        .wall = monotonicTime(),
+        .cpu = processorTime(),
+        .requested = MemoryRequestedBytes()
+    };
+}
+
+// add a measurement to a stage, reportLock must be held
+static void addToStage(StageTimer* timer, StageTimer* now, const char* name,
+    size_t items, const char* itemName) {
+    Stage* stage = NULL;
+    for(unsigned int i = 0; i < stageCount; i++) {
+        if(strcmp(stages[i].name, name) == 0) {
+            stage = &stages[i];
+            break;
+        }
+    }
+    if(stage == NULL) {
+        if(stageCount == STAGE_MAX) {
+            WARN("Too many stages to report %s", name);
+            return;
+        }
+        stage = &stages[stageCount++];
+        *stage = (Stage){.name = name, .itemName = itemName};
+    }
+
+    stage->wall += now->wall - timer->wall;
+    stage->cpu += now->cpu - timer->cpu;
+    stage->requested += now->requested - timer->requested;
+    stage->items += items;
+    stage->runs++;
+}
+
+void stageEnd(StageTimer* timer, const char* stage, size_t items,
+    const char* itemName) {
+    if(!enabled) {
+        return;
+    }
+    StageTimer now = stageBegin();
+
+    pthread_mutex_lock(&reportLock);
+    addToStage(timer, &now, stage, items, itemName);
+    pthread_mutex_unlock(&reportLock);
+}
+
+void stageEndOpcode(StageTimer* timer, const char* name,
+    unsigned int possibilities) {
+    if(!enabled) {
+        return;
+    }
+    StageTimer now = stageBegin();
+
+    pthread_mutex_lock(&reportLock);
+    addToStage(timer, &now, "opcodes", possibilities, "possibilities");
+
+    if(opcodeCount == opcodeCapacity) {
+        opcodeCapacity = opcodeCapacity == 0 ? 64 : opcodeCapacity * 2;
+        opcodes = realloc(opcodes, opcodeCapacity * sizeof(OpcodeTime));
+        if(opcodes == NULL) {
+            abort();
+        }
+    }
+    opcodes[opcodeCount++] = (OpcodeTime){
+        .name = name,
+        .possibilities = possibilities,
+        .wall = now.wall - timer->wall,
+        .cpu = now.cpu - timer->cpu
+    };
+    pthread_mutex_unlock(&reportLock);
+}
+
+static int opcodeWallSort(const void* a, const void* b) {
+    double wallA = ((const OpcodeTime*)a)->wall;
+    double wallB = ((const OpcodeTime*)b)->wall;
+    return (wallA < wallB) - (wallA > wallB);
+}
+
+void timeReportPrint() {
+    if(!enabled) {
+        return;
+    }
+    CONTEXT(INFO, "Time report");
+
+    char line[256];
+    #define REPORT_LINE(...) \
+        do { \
+            snprintf(line, sizeof(line), __VA_ARGS__); \
+            INFO("%s", line); \
+            cErrPrintf(TextWhite, "%s\n", line); \
+        } while(0)
+
+    pthread_mutex_lock(&reportLock);
+
+    REPORT_LINE("%-12s %10s %10s %14s %6s  %s", "stage", "wall ms", "cpu ms",
+        "allocated", "runs", "items");
+    for(unsigned int i = 0; i < stageCount; i++) {
+        Stage* stage = &stages[i];
+        REPORT_LINE("%-12s %10.3f %10.3f %14zu %6u  %zu %s", stage->name,
+            stage->wall * 1000, stage->cpu * 1000, stage->requested,
+            stage->runs, stage->items, stage->itemName);
+    }
+
+    if(opcodeCount > 0) {
+        qsort(opcodes, opcodeCount, sizeof(OpcodeTime), opcodeWallSort);
+
+        size_t shown = opcodeCount < OPCODE_REPORT_COUNT ? opcodeCount :
+            OPCODE_REPORT_COUNT;
+        REPORT_LINE("%s", "");
+        REPORT_LINE("%-24s %10s %10s %14s", "opcode", "wall ms", "cpu ms",
+            "possibilities");
+        for(size_t i = 0; i < shown; i++) {
+            OpcodeTime* opcode = &opcodes[i];
+            REPORT_LINE("%-24s %10.3f %10.3f %14u", opcode->name,
+                opcode->wall * 1000, opcode->cpu * 1000,
+                opcode->possibilities);
+        }
+        if(shown < opcodeCount) {
+            REPORT_LINE("and %zu faster opcodes", opcodeCount - shown);
+        }
+    }
+
+    pthread_mutex_unlock(&reportLock);
+
+    #undef REPORT_LINE
+}
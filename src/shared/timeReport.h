@@ -0,0 +1,38 @@
+#ifndef TIME_REPORT_H
+#define TIME_REPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Time taken by each stage of turning a microcode file into an emulator,
+// summed over every file.  Files analysed in parallel overlap, so their stages
+// can add up to more than the total time.
+
+// where a stage started measuring from
+typedef struct StageTimer {
+    double wall;
+    double cpu;
+    size_t requested;
+} StageTimer;
+
+// start recording stages, must be called before any other threads are started
+void timeReportStart();
+
+bool timeReportEnabled();
+
+// start measuring a stage, does nothing unless the report is enabled
+StageTimer stageBegin();
+
+// add the time since stageBegin to a stage, along with how many items of work
+// it did.  stage and itemName must live as long as the program
+void stageEnd(StageTimer* timer, const char* stage, size_t items,
+    const char* itemName);
+
+// record the analysis of a single opcode as part of the opcode stage
+void stageEndOpcode(StageTimer* timer, const char* name,
+    unsigned int possibilities);
+
+// print every stage, and the opcodes that took longest to analyse
+void timeReportPrint();
+
+#endif